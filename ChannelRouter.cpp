@@ -0,0 +1,190 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "ChannelRouter.h"
+
+#include <string.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define DEFAULT_DEPTH 64
+#define CONTROL_PRIORITY 1 // Command, executable and control channels: responses someone waits on
+#define DATA_PRIORITY 0
+#define LAST_CONTROL_CHANNEL 2
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - ChannelRouter
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// ChannelRouter::ChannelRouter
+// -------------------------------------------------------------------------------------------------
+ChannelRouter::ChannelRouter(void) : nextOrder_(0) {
+    for (unsigned ch = 0; ch <= OTHER; ch++) {
+        setQueue(ch, DEFAULT_DEPTH, (ch <= LAST_CONTROL_CHANNEL) ? CONTROL_PRIORITY : DATA_PRIORITY);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// ChannelRouter::setQueue
+// -------------------------------------------------------------------------------------------------
+int ChannelRouter::setQueue(unsigned channel, size_t depth, int priority) {
+    if (channel > OTHER || depth == 0) {
+        return -1;
+    }
+
+    Queue_t* q = &queues_[channel];
+    std::vector<Slot_t> fresh(depth);
+    q->slots.swap(fresh);
+    q->head = 0;
+    q->count = 0;
+    q->priority = priority;
+    q->highWater = 0;
+    q->dropped = 0;
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ChannelRouter::push
+// -------------------------------------------------------------------------------------------------
+void ChannelRouter::push(const uint8_t* msg, size_t len, const ShtpMsgInfo_t& info, uint32_t t_us) {
+    Queue_t* q = &queues_[(info.channel < SHTP_MAX_CHANNELS) ? info.channel : OTHER];
+    size_t depth = q->slots.size();
+
+    if (q->count == depth) {
+        // Make room by dropping the oldest, fresher data is worth more
+        q->head = (q->head + 1) % depth;
+        q->count--;
+        q->dropped++;
+    }
+
+    Slot_t* slot = &q->slots[(q->head + q->count) % depth];
+    slot->data.assign(msg, msg + len);
+    slot->info = info;
+    slot->t_us = t_us;
+    slot->order = nextOrder_++;
+
+    q->count++;
+    if (q->count > q->highWater) {
+        q->highWater = (uint32_t)q->count;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// ChannelRouter::pop
+// -------------------------------------------------------------------------------------------------
+int ChannelRouter::pop(int channel,
+                       uint8_t* dest,
+                       size_t len,
+                       size_t skip,
+                       uint32_t* t_us,
+                       ShtpMsgInfo_t* info) {
+    Queue_t* q = 0;
+
+    if (channel >= 0) {
+        if (channel <= (int)OTHER && queues_[channel].count > 0) {
+            q = &queues_[channel];
+        }
+    } else {
+        for (unsigned ch = 0; ch <= OTHER; ch++) {
+            Queue_t* c = &queues_[ch];
+            if (c->count == 0) {
+                continue;
+            }
+            // Wrapping difference keeps arrival order right across nextOrder_ overflow
+            if (q == 0 || c->priority > q->priority ||
+                (c->priority == q->priority &&
+                 (int32_t)(c->slots[c->head].order - q->slots[q->head].order) < 0)) {
+                q = c;
+            }
+        }
+    }
+
+    if (q == 0) {
+        return 0;
+    }
+
+    Slot_t* slot = &q->slots[q->head];
+    size_t msgLen = (slot->data.size() > skip) ? slot->data.size() - skip : 0;
+    if (msgLen > len) {
+        msgLen = len;
+    }
+    if (msgLen > 0) {
+        memcpy(dest, &slot->data[skip], msgLen);
+    }
+    *t_us = slot->t_us;
+    if (info != 0) {
+        *info = slot->info;
+    }
+
+    q->head = (q->head + 1) % q->slots.size();
+    q->count--;
+
+    return (int)msgLen;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ChannelRouter::pending
+// -------------------------------------------------------------------------------------------------
+size_t ChannelRouter::pending(void) const {
+    size_t n = 0;
+    for (unsigned ch = 0; ch <= OTHER; ch++) {
+        n += queues_[ch].count;
+    }
+    return n;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ChannelRouter::clear
+// -------------------------------------------------------------------------------------------------
+void ChannelRouter::clear(void) {
+    for (unsigned ch = 0; ch <= OTHER; ch++) {
+        queues_[ch].head = 0;
+        queues_[ch].count = 0;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// ChannelRouter::resetStats
+// -------------------------------------------------------------------------------------------------
+void ChannelRouter::resetStats(void) {
+    for (unsigned ch = 0; ch <= OTHER; ch++) {
+        queues_[ch].highWater = (uint32_t)queues_[ch].count;
+        queues_[ch].dropped = 0;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// ChannelRouter::getStats
+// -------------------------------------------------------------------------------------------------
+void ChannelRouter::getStats(unsigned channel, ChannelQueueStats_t* stats) const {
+    memset(stats, 0, sizeof(*stats));
+    if (channel > OTHER) {
+        return;
+    }
+
+    const Queue_t* q = &queues_[channel];
+    stats->depth = (uint32_t)q->slots.size();
+    stats->priority = q->priority;
+    stats->queued = (uint32_t)q->count;
+    stats->highWater = q->highWater;
+    stats->dropped = q->dropped;
+}
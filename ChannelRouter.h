@@ -0,0 +1,126 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CHANNEL_ROUTER_H
+#define CHANNEL_ROUTER_H
+
+/** @file @brief Per SHTP channel receive queues.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "ShtpInfo.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+// Queue occupancy and losses of one channel, see FtdiHal::getChannelQueueStats
+typedef struct ChannelQueueStats_s {
+    uint32_t depth;     // Configured capacity in messages
+    int priority;       // Higher is served first
+    uint32_t queued;    // Messages waiting now
+    uint32_t highWater; // Most messages ever waiting at once
+    uint32_t dropped;   // Oldest messages discarded because the queue was full
+} ChannelQueueStats_t;
+
+// =================================================================================================
+// CLASS DEFINITION - ChannelRouter
+// =================================================================================================
+/** @brief Bounded queues of decoded messages, one per SHTP channel.
+ *
+ * Messages are served from the highest priority queue that has any, and in arrival order among
+ * queues of equal priority, so a burst of sensor reports can't hold up a command response
+ * waiting behind it. A full queue discards its oldest message to make room; the SHTP sequence
+ * numbers of the channel show the gap.
+ *
+ * Messages that aren't SHTP (ShtpMsgInfo_t::channel out of range) share one extra queue. Slots
+ * keep their storage once grown, so routing doesn't allocate in steady state. Not thread safe;
+ * the owner serializes access.
+ */
+class ChannelRouter {
+public:
+    /** Queue index of messages that aren't on a known channel */
+    static const unsigned OTHER = SHTP_MAX_CHANNELS;
+
+    ChannelRouter(void);
+
+    /** @brief Set the capacity and priority of a channel's queue. Drops what it holds.
+     * @param channel SHTP channel, or OTHER
+     * @param depth capacity in messages, at least 1
+     * @param priority higher is served first
+     * @return 0 on success, -1 if channel or depth is out of range
+     */
+    int setQueue(unsigned channel, size_t depth, int priority);
+
+    /** @brief Queue a message.
+     * @param msg the message as decoded, UART header included
+     * @param len message length
+     * @param info parsed SHTP header of the message
+     * @param t_us receive timestamp
+     */
+    void push(const uint8_t* msg, size_t len, const ShtpMsgInfo_t& info, uint32_t t_us);
+
+    /** @brief Take the next message.
+     * @param channel queue to take from, or -1 for the next by priority
+     * @param dest receives the message minus its first skip bytes
+     * @param len size of dest, longer messages are truncated
+     * @param skip leading bytes to leave out
+     * @param t_us receives the receive timestamp
+     * @param info receives the parsed SHTP header, may be NULL
+     * @return number of bytes placed in dest, 0 if there was no message
+     */
+    int pop(int channel, uint8_t* dest, size_t len, size_t skip, uint32_t* t_us, ShtpMsgInfo_t* info);
+
+    /** @brief Number of messages queued across all channels */
+    size_t pending(void) const;
+
+    /** @brief Drop every queued message, keeping the configuration and counts */
+    void clear(void);
+
+    /** @brief Clear the high water marks and drop counts */
+    void resetStats(void);
+
+    /** @brief Get the occupancy and losses of a queue. */
+    void getStats(unsigned channel, ChannelQueueStats_t* stats) const;
+
+private:
+    typedef struct Slot_s {
+        std::vector<uint8_t> data;
+        ShtpMsgInfo_t info;
+        uint32_t t_us;
+        uint32_t order; // Arrival order, breaks ties between queues of equal priority
+    } Slot_t;
+
+    typedef struct Queue_s {
+        std::vector<Slot_t> slots;
+        size_t head;  // Oldest message
+        size_t count; // Messages queued
+        int priority;
+        uint32_t highWater;
+        uint32_t dropped;
+    } Queue_t;
+
+    Queue_t queues_[SHTP_MAX_CHANNELS + 1];
+    uint32_t nextOrder_;
+};
+
+#endif // CHANNEL_ROUTER_H
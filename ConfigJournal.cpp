@@ -0,0 +1,103 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "ConfigJournal.h"
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define SHTP_HEADER_LEN 4 // Length LSB, length MSB, channel, sequence
+#define SHTP_UART_HEADER 0x01
+#define SHTP_CHAN_CONTROL 2
+#define SH2_SET_FEATURE_CMD 0xFD
+#define SET_FEATURE_LEN 17       // Report ID through sensor specific configuration
+#define REPORT_INTERVAL_OFFSET 5 // Report interval (us, 32 bit LE) within the command
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - ConfigJournal
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// ConfigJournal::ConfigJournal
+// -------------------------------------------------------------------------------------------------
+ConfigJournal::ConfigJournal(void) : count_(0) {
+}
+
+// -------------------------------------------------------------------------------------------------
+// ConfigJournal::record
+// -------------------------------------------------------------------------------------------------
+bool ConfigJournal::record(const uint8_t* msg, size_t len) {
+    if (len < SHTP_HEADER_LEN + SET_FEATURE_LEN || msg[2] != SHTP_CHAN_CONTROL ||
+        msg[SHTP_HEADER_LEN] != SH2_SET_FEATURE_CMD) {
+        return false;
+    }
+
+    const uint8_t* cmd = msg + SHTP_HEADER_LEN;
+    std::vector<uint8_t>& entry = entries_[cmd[1]];
+    uint32_t interval = cmd[REPORT_INTERVAL_OFFSET] | (cmd[REPORT_INTERVAL_OFFSET + 1] << 8) |
+                        (cmd[REPORT_INTERVAL_OFFSET + 2] << 16) |
+                        ((uint32_t)cmd[REPORT_INTERVAL_OFFSET + 3] << 24);
+
+    if (interval == 0) {
+        if (!entry.empty()) {
+            entry.clear();
+            count_--;
+        }
+        return true;
+    }
+
+    if (entry.empty()) {
+        count_++;
+    }
+    entry.assign(msg, msg + len);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ConfigJournal::clear
+// -------------------------------------------------------------------------------------------------
+void ConfigJournal::clear(void) {
+    for (size_t i = 0; i < 256; i++) {
+        entries_[i].clear();
+    }
+    count_ = 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ConfigJournal::encodeAll
+// -------------------------------------------------------------------------------------------------
+size_t ConfigJournal::encodeAll(Rfc1662Framer& framer, std::vector<uint8_t>* out) const {
+    std::vector<uint8_t> msg;
+    size_t n = 0;
+
+    out->clear();
+    for (size_t i = 0; i < 256; i++) {
+        if (entries_[i].empty()) {
+            continue;
+        }
+        msg.assign(1, SHTP_UART_HEADER);
+        msg.insert(msg.end(), entries_[i].begin(), entries_[i].end());
+
+        size_t at = out->size();
+        out->resize(at + framer.maxEncodedLen(msg.size()));
+        out->resize(at + framer.encode(&(*out)[at], &msg[0], msg.size()));
+        n++;
+    }
+    return n;
+}
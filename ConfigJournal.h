@@ -0,0 +1,73 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CONFIG_JOURNAL_H
+#define CONFIG_JOURNAL_H
+
+/** @file @brief Latest sensor configuration sent to the hub, for replay after a hub reset.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "Rfc1662Framer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// =================================================================================================
+// CLASS DEFINITION - ConfigJournal
+// =================================================================================================
+/** @brief The last Set Feature command sent for each sensor.
+ *
+ * A hub reset clears every sensor configuration. Replaying the journal restores them without
+ * waiting for the application to notice the reset and reconfigure. A command that turns a
+ * sensor off removes its entry, sensors are off after a reset anyway. Not thread safe; the owner
+ * serializes access.
+ */
+class ConfigJournal {
+public:
+    ConfigJournal(void);
+
+    /** @brief Record an outgoing SHTP message if it is a Set Feature command.
+     * @param msg SHTP message, starting at the length field (no UART header)
+     * @param len message length
+     * @return true if the message was a Set Feature command
+     */
+    bool record(const uint8_t* msg, size_t len);
+
+    /** @brief Number of sensors with a configuration recorded */
+    size_t count(void) const {
+        return count_;
+    }
+
+    void clear(void);
+
+    /** @brief Encode every recorded command, UART header included, as consecutive frames.
+     * @param framer encodes the frames, with its FCS setting
+     * @param out receives the frames, replacing its contents
+     * @return number of commands encoded
+     */
+    size_t encodeAll(Rfc1662Framer& framer, std::vector<uint8_t>* out) const;
+
+private:
+    std::vector<uint8_t> entries_[256]; // By sensor ID, empty if nothing recorded
+    size_t count_;
+};
+
+#endif // CONFIG_JOURNAL_H
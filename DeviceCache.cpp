@@ -0,0 +1,146 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "DeviceCache.h"
+
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+static std::mutex cacheLock;
+static std::string cacheDir;
+static std::map<std::string, std::vector<uint8_t> > records;
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static std::string recordName(const char* serial, const char* key) {
+    return std::string(serial) + "." + key;
+}
+
+static std::string recordPath(const std::string& name) {
+    return cacheDir + "/" + name;
+}
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - DeviceCache
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// DeviceCache::setDirectory
+// -------------------------------------------------------------------------------------------------
+void DeviceCache::setDirectory(const char* dir) {
+    std::lock_guard<std::mutex> lock(cacheLock);
+    cacheDir = (dir != 0) ? dir : "";
+}
+
+// -------------------------------------------------------------------------------------------------
+// DeviceCache::load
+// -------------------------------------------------------------------------------------------------
+bool DeviceCache::load(const char* serial, const char* key, uint8_t* buf, size_t* len) {
+    if (serial == 0 || serial[0] == 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheLock);
+    std::string name = recordName(serial, key);
+
+    std::map<std::string, std::vector<uint8_t> >::iterator it = records.find(name);
+    if (it == records.end() && !cacheDir.empty()) {
+        // Not seen by this process yet, try the persisted copy
+        FILE* f = fopen(recordPath(name).c_str(), "rb");
+        if (f != 0) {
+            std::vector<uint8_t> data;
+            uint8_t chunk[256];
+            size_t n;
+            while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+                data.insert(data.end(), chunk, chunk + n);
+            }
+            fclose(f);
+            it = records.insert(std::make_pair(name, data)).first;
+        }
+    }
+
+    if (it == records.end() || it->second.size() > *len) {
+        return false;
+    }
+
+    if (!it->second.empty()) {
+        memcpy(buf, &it->second[0], it->second.size());
+    }
+    *len = it->second.size();
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// DeviceCache::store
+// -------------------------------------------------------------------------------------------------
+bool DeviceCache::store(const char* serial, const char* key, const uint8_t* buf, size_t len) {
+    if (serial == 0 || serial[0] == 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheLock);
+    std::string name = recordName(serial, key);
+
+    records[name] = std::vector<uint8_t>(buf, buf + len);
+
+    if (!cacheDir.empty()) {
+        // Write to a temporary file and rename so a concurrent reader never sees a partial record
+        std::string path = recordPath(name);
+        std::string tmpPath = path + ".tmp";
+        FILE* f = fopen(tmpPath.c_str(), "wb");
+        if (f != 0) {
+            bool ok = (fwrite(buf, 1, len, f) == len);
+            ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+            remove(path.c_str()); // rename() does not replace an existing file on Windows
+#endif
+            if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+                fprintf(stderr, "Unable to write device cache %s\n", path.c_str());
+                remove(tmpPath.c_str());
+            }
+        }
+    }
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// DeviceCache::erase
+// -------------------------------------------------------------------------------------------------
+void DeviceCache::erase(const char* serial, const char* key) {
+    if (serial == 0 || serial[0] == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheLock);
+    std::string name = recordName(serial, key);
+
+    records.erase(name);
+    if (!cacheDir.empty()) {
+        remove(recordPath(name).c_str());
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DEVICE_CACHE_H
+#define DEVICE_CACHE_H
+
+/** @file @brief Small per-device key/value store used to remember results between opens.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include <stddef.h>
+#include <stdint.h>
+
+// =================================================================================================
+// CLASS DEFINITION - DeviceCache
+// =================================================================================================
+/** @brief Records keyed by device serial number and record name.
+ *
+ * Records are always kept in memory for the life of the process. If a directory has been set
+ * with setDirectory() they are also written to "<dir>/<serial>.<key>" so that they survive a
+ * process restart. All methods are thread safe.
+ */
+class DeviceCache {
+public:
+    /** @brief Set the directory used to persist records, NULL to keep them in memory only.
+     * The directory must already exist.
+     */
+    static void setDirectory(const char* dir);
+
+    /** @brief Look up a record.
+     * @param serial device serial number
+     * @param key record name
+     * @param buf where to copy the record
+     * @param len in: size of buf, out: length of the record
+     * @return true if the record was found and fit in buf
+     */
+    static bool load(const char* serial, const char* key, uint8_t* buf, size_t* len);
+
+    /** @brief Store (or replace) a record.
+     * @return true if the record was stored in memory (persisting to disk is best effort)
+     */
+    static bool store(const char* serial, const char* key, const uint8_t* buf, size_t len);
+
+    /** @brief Remove a record from memory and disk */
+    static void erase(const char* serial, const char* key);
+};
+
+#endif // DEVICE_CACHE_H
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "FrameCache.h"
+
+#include <string.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+// FNV-1a, payloads are a handful of bytes
+static uint64_t payload_hash(const uint8_t* p, size_t len) {
+    uint64_t h = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * FNV_PRIME;
+    }
+    return h;
+}
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - FrameCache
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// FrameCache::FrameCache
+// -------------------------------------------------------------------------------------------------
+FrameCache::FrameCache(size_t entries) : entries_(entries), hits_(0), misses_(0) {
+}
+
+// -------------------------------------------------------------------------------------------------
+// FrameCache::setCapacity
+// -------------------------------------------------------------------------------------------------
+void FrameCache::setCapacity(size_t entries) {
+    std::vector<Entry_t> fresh(entries);
+    entries_.swap(fresh);
+    hits_ = 0;
+    misses_ = 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FrameCache::lookup
+// -------------------------------------------------------------------------------------------------
+const uint8_t* FrameCache::lookup(Rfc1662Framer& framer,
+                                  const uint8_t* src,
+                                  size_t len,
+                                  size_t* stuffedLen) {
+    if (entries_.empty() || len == 0) {
+        return 0;
+    }
+
+    uint64_t hash = payload_hash(src, len);
+    Entry_t& e = entries_[hash % entries_.size()];
+
+    if (e.hash == hash && e.payload.size() == len && memcmp(&e.payload[0], src, len) == 0) {
+        hits_++;
+    } else {
+        misses_++;
+        e.hash = hash;
+        e.payload.assign(src, src + len);
+        e.stuffed.resize(2 * len);
+        e.stuffed.resize(framer.encode(&e.stuffed[0], src, len, Rfc1662Framer::MIDDLE));
+    }
+
+    *stuffedLen = e.stuffed.size();
+    return &e.stuffed[0];
+}
+
+// -------------------------------------------------------------------------------------------------
+// FrameCache::clear
+// -------------------------------------------------------------------------------------------------
+void FrameCache::clear(void) {
+    setCapacity(entries_.size());
+}
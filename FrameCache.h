@@ -0,0 +1,89 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+/** @file @brief Cache of already byte stuffed command payloads.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "Rfc1662Framer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// =================================================================================================
+// CLASS DEFINITION - FrameCache
+// =================================================================================================
+/** @brief Byte stuffed payloads keyed by a hash of the raw payload.
+ *
+ * The host sends the same few commands over and over; only the SHTP header in front of them
+ * (which carries the sequence number) changes between sends. Caching the stuffed payload lets
+ * the frame be assembled from the stuffed header and a copy of the cached bytes.
+ *
+ * Entries are direct mapped by hash, a colliding payload replaces the older one. Payloads are
+ * compared in full, so a hash collision costs a re-encode but never sends the wrong bytes.
+ * Not thread safe; the owner serializes access.
+ */
+class FrameCache {
+public:
+    explicit FrameCache(size_t entries = 16);
+
+    /** @brief Change the number of entries, 0 disables the cache. Drops everything cached. */
+    void setCapacity(size_t entries);
+
+    size_t capacity(void) const {
+        return entries_.size();
+    }
+
+    /** @brief Get the stuffed form of a payload, stuffing and caching it on a miss.
+     * @param framer encodes on a miss, without flags. Must be set to FCS_NONE: an FCS covers
+     * the header as well, so frames with one can't be assembled from cached pieces.
+     * @param src payload
+     * @param len payload length
+     * @param stuffedLen receives the length of the stuffed bytes
+     * @return the stuffed bytes, valid until the next lookup(), NULL if the cache is disabled
+     */
+    const uint8_t* lookup(Rfc1662Framer& framer, const uint8_t* src, size_t len, size_t* stuffedLen);
+
+    /** @brief Drop everything cached and clear the counts */
+    void clear(void);
+
+    uint32_t hits(void) const {
+        return hits_;
+    }
+    uint32_t misses(void) const {
+        return misses_;
+    }
+
+private:
+    typedef struct Entry_s {
+        uint64_t hash;
+        std::vector<uint8_t> payload;
+        std::vector<uint8_t> stuffed;
+    } Entry_t;
+
+    std::vector<Entry_t> entries_;
+    uint32_t hits_;
+    uint32_t misses_;
+};
+
+#endif // FRAME_CACHE_H
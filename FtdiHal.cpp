@@ -16,6 +16,7 @@
  */
 
 #include "FtdiHal.h"
+#include "DeviceCache.h"
 #include "TimerService.h"
 
 #include <chrono>
@@ -30,9 +31,64 @@
 // =================================================================================================
 #define TRACE_IO 0
 
+#define SHTP_CHAN_CONTROL 2
+#define SH2_GET_FEATURE_REQ 0xFE
+#define SH2_GET_FEATURE_RESP 0xFC
+#define PROBE_SENSOR_ID 0x01 // Accelerometer, only its configuration is read back
+#define PROBE_BURST 8
+#define PROBE_TIMEOUT_US 100000
+#define PACING_CACHE_KEY "txpacing"
+#define DEFAULT_MAX_READ 1024
+#define SHTP_HEADER_LEN 4      // Length LSB, length MSB, channel, sequence
+#define SHTP_UART_HEADER 0x01
+#define SHTP_CHAN_COMMAND 0
+#define SHTP_ADVERTISEMENT 0x00
+#define SHTP_CONTINUATION 0x8000
+#define SHTP_CHAN_EXECUTABLE 1
+#define SH2_EXEC_RESET 1       // Host to hub: reset. Hub to host: reset complete.
+#define RESET_EXPECT_US 2000000 // How long after asking for a reset the hub's is ours
+#define ADVERT_CACHE_KEY "advert"
+#define ADVERT_MAX_LEN 2048
+#define SH2_TIMESTAMP_REBASE 0xFA
+#define SH2_BASE_TIMESTAMP_REF 0xFB
+#define SHTP_CHAN_SENSOR_NORMAL 3
+#define SHTP_CHAN_SENSOR_WAKE 4
+#define SHTP_CHAN_GYRO_RV 5
+#define SH2_GYRO_INTEGRATED_RV 0x2A
+#define GYRO_RV_MAX_LEN 16
+
 // =================================================================================================
 // DATA TYPES
 // =================================================================================================
+typedef struct PacingStep_s {
+    DWORD chunkLen;
+    DWORD gap_us;
+} PacingStep_t;
+
+// =================================================================================================
+// LOCAL CONST VARIABLES
+// =================================================================================================
+// Calibration ladder, from the historical 200us/byte towards writing a frame in one go
+static const PacingStep_t PACING_STEPS[] = {
+        {1, 200},
+        {1, 100},
+        {1, 50},
+        {2, 50},
+        {4, 50},
+        {8, 50},
+        {16, 25},
+        {64, 0},
+};
+
+// Soft reset: UART header, SHTP length 5, executable channel, sequence 1, reset command. No byte
+// needs escaping, so the frame is just the command between flags.
+static constexpr uint8_t SOFTRESET_CMD[] = {SHTP_UART_HEADER, 0x05, 0x00, 0x01, 1, 0x01};
+static constexpr uint8_t SOFTRESET_FRAME[] = {0x7E, SHTP_UART_HEADER, 0x05, 0x00, 0x01, 1, 0x01, 0x7E};
+static_assert(Rfc1662Framer::isEncodingOf(SOFTRESET_CMD,
+                                          sizeof(SOFTRESET_CMD),
+                                          SOFTRESET_FRAME,
+                                          sizeof(SOFTRESET_FRAME)),
+              "SOFTRESET_FRAME must be the RFC1662 encoding of SOFTRESET_CMD");
 
 // =================================================================================================
 // LOCAL VARIABLES
@@ -41,10 +97,22 @@
 // =================================================================================================
 // LOCAL FUNCTIONS PROTOTYPES
 // =================================================================================================
+static bool shtp_header_info(const uint8_t* msg, size_t len, ShtpMsgInfo_t* info);
+static size_t report_len(uint8_t reportId);
+static bool reports_wanted(const uint8_t* payload, size_t len, const uint32_t reportIds[8]);
 
 // =================================================================================================
 // PUBLIC FUNCTIONS - FtdiHal
 // =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::~FtdiHal
+// -------------------------------------------------------------------------------------------------
+FtdiHal::~FtdiHal() {
+    free(msgInfo_);
+    free(spans_);
+    free(decodeBuf_);
+}
+
 // -------------------------------------------------------------------------------------------------
 // FtdiHal::init
 // -------------------------------------------------------------------------------------------------
@@ -53,17 +121,63 @@ int FtdiHal::init(int deviceIdx, TimerSrv* timer) {
     timer_ = timer;
     nRemainMsg_ = 0;
 
-    framer_.decodeInit(decodeBuf_, sizeof(decodeBuf_));
+    if (decodeBuf_ == 0) {
+        return SetDecodeBufLen(DEFAULT_MAX_READ);
+    }
+    ResetDecoder();
 
     return 0;
 }
 
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::openWithDeadline
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::openWithDeadline(uint32_t timeout_us) {
+    openDeadline_us_ = timer_->getTimestamp_us() + timeout_us;
+    int status = open();
+    uint64_t deadline = openDeadline_us_;
+    openDeadline_us_ = 0;
+    if (status != 0) {
+        return (status == -2) ? -2 : -1;
+    }
+    if (openTiming_.warm) {
+        return 0; // The cached advertisement is already queued
+    }
+
+    for (;;) {
+        if (DecodeAvailable() > 0 && KeepFromAdvert()) {
+            MarkOpenPhase(&openTiming_.advert_us);
+            return 0;
+        }
+        if (timer_->getTimestamp_us() >= deadline) {
+            MarkOpenPhase(&openTiming_.advert_us);
+            fprintf(stderr, "No advertisement within %u us\n", timeout_us);
+            return -2;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::getOpenTiming
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::getOpenTiming(OpenTiming_t* timing) {
+    *timing = openTiming_;
+}
+
 // -------------------------------------------------------------------------------------------------
 // FtdiHal::softreset
 // -------------------------------------------------------------------------------------------------
 void FtdiHal::softreset() {
-    UCHAR cmd1[] = {0x01, 0x05, 0x00, 0x01, 1, 0x01};
-    writeData(cmd1, sizeof(cmd1));
+    ExpectReset();
+    if (framer_.fcs() == Rfc1662Framer::FCS_NONE) {
+        UCHAR frame[sizeof(SOFTRESET_FRAME)];
+        memcpy(frame, SOFTRESET_FRAME, sizeof(frame));
+        WriteEncodedFrame(frame, sizeof(frame));
+    } else {
+        UCHAR cmd1[sizeof(SOFTRESET_CMD)];
+        memcpy(cmd1, SOFTRESET_CMD, sizeof(cmd1));
+        writeData(cmd1, sizeof(cmd1));
+    }
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -95,6 +209,155 @@ int FtdiHal::readData(uint8_t* pBuffer, unsigned len, uint32_t* t_us) {
     return ReadMessage(pBuffer, len, t_us, 0);
 }
 
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::readWithInfo
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::readWithInfo(uint8_t* pBuffer, unsigned len, uint32_t* t_us, ShtpMsgInfo_t* info) {
+    return ReadMessage(pBuffer, len, t_us, 1, info);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::getShtpStats
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::getShtpStats(ShtpChannelStats_t stats[SHTP_MAX_CHANNELS]) {
+    memcpy(stats, shtpStats_, sizeof(shtpStats_));
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setChannelRouting
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::setChannelRouting(bool enable) {
+    if (enable == routing_) {
+        return;
+    }
+
+    routing_ = enable;
+    if (enable) {
+        RouteMessages();
+    } else {
+        router_.clear();
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setChannelQueue
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::setChannelQueue(unsigned channel, unsigned depth, int priority) {
+    if (router_.setQueue(channel, depth, priority) != 0) {
+        fprintf(stderr, "Invalid queue %u depth %u\n", channel, depth);
+        return -1;
+    }
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::readChannel
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::readChannel(unsigned channel,
+                         uint8_t* pBuffer,
+                         unsigned len,
+                         uint32_t* t_us,
+                         ShtpMsgInfo_t* info) {
+    if (!routing_ || channel > ChannelRouter::OTHER) {
+        return -1;
+    }
+
+    // Strip the UART header like read()
+    int rtnLen = router_.pop((int)channel, pBuffer, len, 1, t_us, info);
+    if (rtnLen) {
+        return rtnLen;
+    }
+
+    if (DecodeAvailable() > 0) {
+        RouteMessages();
+    }
+    return router_.pop((int)channel, pBuffer, len, 1, t_us, info);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::getChannelQueueStats
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::getChannelQueueStats(unsigned channel, ChannelQueueStats_t* stats) {
+    router_.getStats(channel, stats);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setReportFilter
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::setReportFilter(unsigned channel, const uint32_t reportIds[8]) {
+    if (channel >= SHTP_MAX_CHANNELS) {
+        fprintf(stderr, "Invalid channel %u\n", channel);
+        return -1;
+    }
+
+    memcpy(reportFilter_[channel], reportIds, sizeof(reportFilter_[channel]));
+    filteredChannels_ |= (uint8_t)(1 << channel);
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::clearReportFilter
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::clearReportFilter(unsigned channel) {
+    if (channel < SHTP_MAX_CHANNELS) {
+        filteredChannels_ &= (uint8_t)~(1 << channel);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setConfigJournal
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::setConfigJournal(bool enable) {
+    journalEnabled_ = enable;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::clearConfigJournal
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::clearConfigJournal(void) {
+    journal_.clear();
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::getConfigJournalStats
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::getConfigJournalStats(ConfigJournalStats_t* stats) {
+    *stats = journalStats_;
+    stats->entries = (uint32_t)journal_.count();
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setWarmAttach
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::setWarmAttach(bool enable, uint32_t probe_us) {
+    warmAttach_ = enable;
+    warmProbeUs_ = probe_us;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::addReportSink
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::addReportSink(ReportSink* sink) {
+    for (size_t i = 0; i < sinks_.size(); i++) {
+        if (sinks_[i] == sink) {
+            return;
+        }
+    }
+    sinks_.push_back(sink);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::removeReportSink
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::removeReportSink(ReportSink* sink) {
+    for (size_t i = 0; i < sinks_.size(); i++) {
+        if (sinks_[i] == sink) {
+            sinks_.erase(sinks_.begin() + i);
+            return;
+        }
+    }
+}
+
 // -------------------------------------------------------------------------------------------------
 // FtdiHal::write
 // -------------------------------------------------------------------------------------------------
@@ -105,6 +368,18 @@ int FtdiHal::write(uint8_t* pBuffer, unsigned len) {
         return 0;
     }
 
+    if (journalEnabled_) {
+        journal_.record(pBuffer, len);
+    }
+    if (len > SHTP_HEADER_LEN && pBuffer[2] == SHTP_CHAN_EXECUTABLE &&
+        pBuffer[SHTP_HEADER_LEN] == SH2_EXEC_RESET) {
+        ExpectReset();
+    }
+
+    if (WriteCached(pBuffer, len)) {
+        return len;
+    }
+
     UCHAR headerData[] = {0x1}; // SHTP over UART header byte
     DWORD headerLength = sizeof(headerData);
 
@@ -120,13 +395,77 @@ int FtdiHal::write(uint8_t* pBuffer, unsigned len) {
     return len;
 }
 
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setTxPacing
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::setTxPacing(unsigned chunkLen, unsigned gap_us) {
+    txChunkLen_ = (chunkLen > 0) ? chunkLen : 1;
+    txGapUs_ = gap_us;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::getTxPacing
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::getTxPacing(unsigned* chunkLen, unsigned* gap_us) {
+    *chunkLen = txChunkLen_;
+    *gap_us = txGapUs_;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setTxCalibration
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::setTxCalibration(bool enable) {
+    calibrateTx_ = enable;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setRtProfile
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::setRtProfile(const RtProfile& profile, unsigned* failed) {
+    rtProfile_ = profile;
+
+    int status = profile.forDevice(deviceIdx_).apply(failed);
+    PrefaultBuffers();
+
+    return status;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setTxFrameCache
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::setTxFrameCache(unsigned entries) {
+    txCache_.setCapacity(entries);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::getTxFrameCacheStats
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::getTxFrameCacheStats(uint32_t* hits, uint32_t* misses) {
+    *hits = txCache_.hits();
+    *misses = txCache_.misses();
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::setFcs
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::setFcs(Rfc1662Framer::Fcs_e fcs) {
+    framer_.setFcs(fcs);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::getRxStats
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::getRxStats(Rfc1662Stats_t* stats) {
+    framer_.getStats(stats);
+}
+
 // -------------------------------------------------------------------------------------------------
 // FtdiHal::writeData
 // -------------------------------------------------------------------------------------------------
 // send some data to the device.  data will be encoded/framed.
 // -------------------------------------------------------------------------------------------------
 int FtdiHal::writeData(uint8_t* bytes, unsigned length) {
-    UCHAR* encodedFrame = (UCHAR*)malloc((length * 2 + 2) * sizeof(UCHAR));
+    UCHAR* encodedFrame = (UCHAR*)malloc(framer_.maxEncodedLen(length) * sizeof(UCHAR));
     size_t encodedLength = 0;
 
 #if TRACE_IO
@@ -165,41 +504,564 @@ void FtdiHal::PrintBytes(uint8_t* bytes, DWORD len) {
 // writes an already-encoded frame to the device
 // -------------------------------------------------------------------------------------------------
 void FtdiHal::WriteEncodedFrame(UCHAR* bytes, DWORD length) {
-    DWORD bytesToWrite = length;
     DWORD bytesWritten = 0;
 
 
-    // write bytes individually so hub can keep up
-    for (DWORD i = 0; i < length; i++) {
-        BOOL status = WriteBytesToDevice(&bytes[i], 1, &bytesWritten);
+    // write bytes in small chunks so hub can keep up
+    for (DWORD i = 0; i < length; i += txChunkLen_) {
+        DWORD n = (length - i < txChunkLen_) ? (length - i) : txChunkLen_;
+        BOOL status = WriteBytesToDevice(&bytes[i], n, &bytesWritten);
         if (!status) {
             fprintf(stderr, "WriteBytesToDevice failed!\n");
         }
     }
 }
 
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::WriteCached
+// -------------------------------------------------------------------------------------------------
+// Frames an SHTP message (no UART header) from its stuffed header and the cached stuffed
+// payload. Returns false if the cache can't be used, the caller then encodes as usual.
+// -------------------------------------------------------------------------------------------------
+bool FtdiHal::WriteCached(const uint8_t* pBuffer, unsigned len) {
+    const uint8_t* stuffed;
+    size_t stuffedLen;
+    uint8_t header[1 + SHTP_HEADER_LEN];
+
+    if (len <= SHTP_HEADER_LEN || framer_.fcs() != Rfc1662Framer::FCS_NONE) {
+        return false;
+    }
+    stuffed = txCache_.lookup(framer_, pBuffer + SHTP_HEADER_LEN, len - SHTP_HEADER_LEN, &stuffedLen);
+    if (stuffed == 0) {
+        return false;
+    }
+
+    header[0] = SHTP_UART_HEADER;
+    memcpy(header + 1, pBuffer, SHTP_HEADER_LEN);
+
+    txFrame_.resize(framer_.maxEncodedLen(sizeof(header)) + stuffedLen);
+    size_t n = framer_.encode(&txFrame_[0], header, sizeof(header), Rfc1662Framer::FIRST);
+    memcpy(&txFrame_[n], stuffed, stuffedLen);
+    n += stuffedLen;
+    txFrame_[n++] = Rfc1662Framer::FLAG;
+
+#if TRACE_IO
+    fprintf(stderr, "[cached  => ] ");
+    PrintBytes(&txFrame_[0], (DWORD)n);
+#endif
+
+    WriteEncodedFrame(&txFrame_[0], (DWORD)n);
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::PrefaultBuffers
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::PrefaultBuffers(void) {
+    RtProfile::prefault(decodeBuf_, decodeBufLen_);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::CalibrateTxPacing
+// -------------------------------------------------------------------------------------------------
+// Finds the fastest pacing at which the hub answers every probe in a burst. Must run before the
+// soft reset in open(): any messages read while probing are discarded.
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::CalibrateTxPacing(void) {
+    uint32_t cached[2];
+    size_t cachedLen = sizeof(cached);
+
+    if (DeviceCache::load(serial_, PACING_CACHE_KEY, (uint8_t*)cached, &cachedLen) &&
+        cachedLen == sizeof(cached)) {
+        setTxPacing(cached[0], cached[1]);
+        return 0;
+    }
+
+    // Burst of Get Feature requests, each gets exactly one Get Feature response
+    UCHAR probe[] = {0x01, 0x06, 0x00, SHTP_CHAN_CONTROL, 0, SH2_GET_FEATURE_REQ, PROBE_SENSOR_ID};
+    UCHAR* burst = (UCHAR*)malloc(PROBE_BURST * framer_.maxEncodedLen(sizeof(probe)));
+    // Whole messages: anything the decoder can produce may arrive while probing
+    uint8_t* msg = (uint8_t*)malloc(decodeBufLen_);
+    if (burst == 0 || msg == 0) {
+        fprintf(stderr, "TX pacing calibration: out of memory\n");
+        free(burst);
+        free(msg);
+        return -1;
+    }
+    DWORD burstLen = 0;
+    for (int i = 0; i < PROBE_BURST; i++) {
+        probe[4] = (UCHAR)i; // SHTP sequence number
+        burstLen += framer_.encode(burst + burstLen, probe, sizeof(probe));
+    }
+
+    int lastGood = -1;
+    int nSteps = sizeof(PACING_STEPS) / sizeof(PACING_STEPS[0]);
+    for (int step = 0; step < nSteps; step++) {
+        setTxPacing(PACING_STEPS[step].chunkLen, PACING_STEPS[step].gap_us);
+        WriteEncodedFrame(burst, burstLen);
+
+        int responses = 0;
+        uint32_t t_us;
+        uint64_t start = timer_->getTimestamp_us();
+        while (responses < PROBE_BURST &&
+               timer_->getTimestamp_us() - start < PROBE_TIMEOUT_US) {
+            int len = ReadMessage(msg, (unsigned)decodeBufLen_, &t_us, 0);
+            if (len > 5 && msg[3] == SHTP_CHAN_CONTROL && msg[5] == SH2_GET_FEATURE_RESP) {
+                responses++;
+            }
+        }
+
+        if (responses < PROBE_BURST) {
+            break;
+        }
+        lastGood = step;
+    }
+    free(burst);
+    free(msg);
+
+    // Whatever is left over is stale once the hub is reset
+    ResetDecoder();
+
+    if (lastGood < 0) {
+        // Hub did not answer at all, keep the conservative pacing and don't cache anything
+        setTxPacing(PACING_STEPS[0].chunkLen, PACING_STEPS[0].gap_us);
+        fprintf(stderr, "TX pacing calibration failed, using %u us/byte\n", txGapUs_);
+        return -1;
+    }
+
+    setTxPacing(PACING_STEPS[lastGood].chunkLen, PACING_STEPS[lastGood].gap_us);
+    cached[0] = txChunkLen_;
+    cached[1] = txGapUs_;
+    DeviceCache::store(serial_, PACING_CACHE_KEY, (const uint8_t*)cached, sizeof(cached));
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::SetDecodeBufLen
+// -------------------------------------------------------------------------------------------------
+// A read can complete the message in progress and then hold only tiny frames, which decode to
+// 3 bytes for every 2 on the wire. Leave room for that plus the largest message in progress.
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::SetDecodeBufLen(size_t maxRead) {
+    size_t len = maxRead + maxRead / 2 + 512;
+    size_t maxSpans = len / 2 + 1; // A message takes at least 2 encoded bytes
+
+    if (len != decodeBufLen_) {
+        uint8_t* buf = (uint8_t*)malloc(len);
+        Rfc1662Span_t* spans = (Rfc1662Span_t*)malloc(maxSpans * sizeof(Rfc1662Span_t));
+        ShtpMsgInfo_t* info = (ShtpMsgInfo_t*)malloc(maxSpans * sizeof(ShtpMsgInfo_t));
+        if (buf == 0 || spans == 0 || info == 0) {
+            free(buf);
+            free(spans);
+            free(info);
+            fprintf(stderr, "Unable to allocate %u byte decode buffer\n", (unsigned)len);
+            return -1;
+        }
+        free(decodeBuf_);
+        free(spans_);
+        free(msgInfo_);
+        decodeBuf_ = buf;
+        decodeBufLen_ = len;
+        spans_ = spans;
+        msgInfo_ = info;
+        maxSpans_ = maxSpans;
+    }
+
+    ResetDecoder();
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::ResetDecoder
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::ResetDecoder(void) {
+    nRemainMsg_ = 0;
+    router_.clear();
+    ResetShtpSeq();
+    if (inPlaceDecode_) {
+        framer_.decodeInitInPlace(decodeBuf_, decodeBufLen_);
+    } else {
+        framer_.decodeInit(decodeBuf_, decodeBufLen_);
+    }
+    framer_.decodeSpans(spans_, maxSpans_);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::ResetShtpTracking
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::ResetShtpTracking(void) {
+    ResetShtpSeq();
+    memset(shtpStats_, 0, sizeof(shtpStats_));
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::ResetShtpSeq
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::ResetShtpSeq(void) {
+    for (int ch = 0; ch < SHTP_MAX_CHANNELS; ch++) {
+        shtpNextSeq_[ch] = -1;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::ParseShtpHeaders
+// -------------------------------------------------------------------------------------------------
+// Runs right after each decode, while the headers just written are still in cache, so nothing
+// downstream has to rescan the messages for them. Applies the report filters too and returns how
+// many messages are left.
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::ParseShtpHeaders(int nMsg) {
+    int kept = 0;
+
+    for (int i = 0; i < nMsg; i++) {
+        const uint8_t* msg = spans_[i].data;
+        size_t msgLen = spans_[i].len;
+        ShtpMsgInfo_t* info = &msgInfo_[kept];
+
+        // Filtered messages are squeezed out of the list, so nothing downstream copies them
+        spans_[kept] = spans_[i];
+        kept++;
+
+        if (!shtp_header_info(msg, msgLen, info) || info->channel >= SHTP_MAX_CHANNELS) {
+            continue;
+        }
+
+        // The hub numbers every channel from 0 again after it resets
+        if (info->channel == SHTP_CHAN_COMMAND && msgLen > 1 + SHTP_HEADER_LEN &&
+            msg[1 + SHTP_HEADER_LEN] == SHTP_ADVERTISEMENT) {
+            ResetShtpSeq();
+            HubResetSeen(true);
+            if (warmAttach_ && serial_[0] != 0) {
+                DeviceCache::store(serial_, ADVERT_CACHE_KEY, msg, msgLen);
+            }
+        } else if (info->channel == SHTP_CHAN_EXECUTABLE && msgLen > 1 + SHTP_HEADER_LEN &&
+                   msg[1 + SHTP_HEADER_LEN] == SH2_EXEC_RESET) {
+            HubResetSeen(false);
+        }
+
+        ShtpChannelStats_t* stats = &shtpStats_[info->channel];
+        int16_t expected = shtpNextSeq_[info->channel];
+        if (expected >= 0 && info->seq != expected) {
+            info->lost = (uint8_t)(info->seq - expected);
+            stats->gaps++;
+            stats->lost += info->lost;
+        }
+        shtpNextSeq_[info->channel] = (uint8_t)(info->seq + 1);
+
+        stats->messages++;
+        if (info->lengthMismatch) {
+            stats->lengthMismatches++;
+        } else if ((filteredChannels_ & (1 << info->channel)) &&
+                   !reports_wanted(msg + 1 + SHTP_HEADER_LEN, msgLen - 1 - SHTP_HEADER_LEN,
+                                   reportFilter_[info->channel])) {
+            stats->filtered++;
+            kept--;
+        }
+    }
+
+    return kept;
+}
+
 // -------------------------------------------------------------------------------------------------
 // FtdiHal::ReadMessage
 // -------------------------------------------------------------------------------------------------
-int FtdiHal::ReadMessage(uint8_t* pBuffer, unsigned len, uint32_t* t_us, uint8_t stripHeaderLen) {
+int FtdiHal::ReadMessage(uint8_t* pBuffer,
+                         unsigned len,
+                         uint32_t* t_us,
+                         uint8_t stripHeaderLen,
+                         ShtpMsgInfo_t* info) {
 
     int rtnLen = 0;
 
+    if (!injected_.empty()) {
+        return PopInjected(pBuffer, len, t_us, stripHeaderLen, info);
+    }
+
+    if (routing_) {
+        rtnLen = router_.pop(-1, pBuffer, len, stripHeaderLen, t_us, info);
+        if (rtnLen) {
+            return rtnLen;
+        }
+        if (DecodeAvailable() > 0) {
+            RouteMessages();
+        }
+        return router_.pop(-1, pBuffer, len, stripHeaderLen, t_us, info);
+    }
+
     // Return the buffered decoded messages minus header bytes
-    rtnLen = GetNextMessage(pBuffer, len, t_us, stripHeaderLen);
+    rtnLen = GetNextMessage(pBuffer, len, t_us, stripHeaderLen, info);
     if (rtnLen) {
         return rtnLen;
     }
 
+    DecodeAvailable();
+
+    return GetNextMessage(pBuffer, len, t_us, stripHeaderLen, info);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::StartOpenTiming
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::StartOpenTiming(void) {
+    memset(&openTiming_, 0, sizeof(openTiming_));
+    openStart_us_ = timer_->getTimestamp_us();
+    openMark_us_ = openStart_us_;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::MarkOpenPhase
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::MarkOpenPhase(uint32_t* phase) {
+    uint64_t now = timer_->getTimestamp_us();
+    *phase += (uint32_t)(now - openMark_us_);
+    openTiming_.total_us = (uint32_t)(now - openStart_us_);
+    openMark_us_ = now;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::OpenExpired
+// -------------------------------------------------------------------------------------------------
+bool FtdiHal::OpenExpired(void) {
+    return openDeadline_us_ != 0 && timer_->getTimestamp_us() >= openDeadline_us_;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::KeepFromAdvert
+// -------------------------------------------------------------------------------------------------
+// Looks for the advertisement among the messages just decoded. If found, drops the messages
+// ahead of it and keeps it and the rest queued. Otherwise drops them all.
+// -------------------------------------------------------------------------------------------------
+bool FtdiHal::KeepFromAdvert(void) {
+    for (int i = nextSpan_; i < nextSpan_ + nRemainMsg_; i++) {
+        if (msgInfo_[i].channel == SHTP_CHAN_COMMAND && spans_[i].len > 1 + SHTP_HEADER_LEN &&
+            spans_[i].data[1 + SHTP_HEADER_LEN] == SHTP_ADVERTISEMENT) {
+            nRemainMsg_ -= i - nextSpan_;
+            nextSpan_ = i;
+            if (routing_) {
+                RouteMessages();
+            }
+            return true;
+        }
+    }
+
+    nRemainMsg_ = 0;
+    return false;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::ExpectReset
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::ExpectReset(void) {
+    resetExpected_ = true;
+    resetRequested_us_ = timer_->getTimestamp_us();
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::HubResetSeen
+// -------------------------------------------------------------------------------------------------
+// The hub announces a reset with its advertisement, then a reset complete message; whichever
+// shows up first stands for the reset.
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::HubResetSeen(bool advert) {
+    if (!advert && sawAdvert_) {
+        sawAdvert_ = false;
+        return;
+    }
+    sawAdvert_ = advert;
+
+    bool expected =
+            resetExpected_ && timer_->getTimestamp_us() - resetRequested_us_ < RESET_EXPECT_US;
+    resetExpected_ = false;
+    if (expected) {
+        return;
+    }
+
+    journalStats_.hubResets++;
+    if (journalEnabled_ && journal_.count() > 0) {
+        replayPending_ = true;
+        resetSeen_us_ = timer_->getTimestamp_us();
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::ReplayJournal
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::ReplayJournal(void) {
+    replayPending_ = false;
+
+    size_t n = journal_.encodeAll(framer_, &replayBurst_);
+    if (n == 0) {
+        return;
+    }
+    WriteEncodedFrame(&replayBurst_[0], (DWORD)replayBurst_.size());
+
+    journalStats_.replays++;
+    journalStats_.commandsReplayed += (uint32_t)n;
+    journalStats_.lastReplay_us = (uint32_t)(timer_->getTimestamp_us() - resetSeen_us_);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::TryWarmAttach
+// -------------------------------------------------------------------------------------------------
+// Called by open() in place of the soft reset. The hub is left running if it is already sending
+// valid frames and its advertisement is cached: the cached copy is queued for the sh2 layer,
+// which needs one to start. Returns false if the caller should reset the hub as usual.
+// -------------------------------------------------------------------------------------------------
+bool FtdiHal::TryWarmAttach(void) {
+    uint8_t advert[ADVERT_MAX_LEN];
+    size_t advertLen = sizeof(advert);
+    ShtpMsgInfo_t info;
+
+    openTiming_.warm = false;
+    injected_.clear();
+    if (!warmAttach_ || serial_[0] == 0 ||
+        !DeviceCache::load(serial_, ADVERT_CACHE_KEY, advert, &advertLen) ||
+        !shtp_header_info(advert, advertLen, &info)) {
+        return false;
+    }
+
+    uint64_t start = timer_->getTimestamp_us();
+    bool streaming = false;
+    while (!streaming && timer_->getTimestamp_us() - start < warmProbeUs_) {
+        if (DecodeAvailable() <= 0) {
+            continue;
+        }
+        for (int i = nextSpan_; i < nextSpan_ + nRemainMsg_; i++) {
+            if (msgInfo_[i].channel < SHTP_MAX_CHANNELS && !msgInfo_[i].lengthMismatch) {
+                streaming = true;
+            }
+        }
+    }
+    if (!streaming) {
+        return false;
+    }
+
+    uint32_t now = (uint32_t)timer_->getTimestamp_us();
+    if (routing_) {
+        router_.push(advert, advertLen, info, now);
+    } else {
+        injected_.assign(advert, advert + advertLen);
+        injectedInfo_ = info;
+        injectedTime_us_ = now;
+    }
+    openTiming_.warm = true;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::MessagesQueued
+// -------------------------------------------------------------------------------------------------
+bool FtdiHal::MessagesQueued(void) const {
+    return !injected_.empty() || nRemainMsg_ > 0 || (routing_ && router_.pending() > 0);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::PopInjected
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::PopInjected(uint8_t* pBuffer,
+                         unsigned len,
+                         uint32_t* t_us,
+                         uint8_t stripHeaderLen,
+                         ShtpMsgInfo_t* info) {
+    size_t payloadLen = injected_.size() - stripHeaderLen;
+    if (payloadLen > len) {
+        payloadLen = len;
+    }
+    memcpy(pBuffer, &injected_[stripHeaderLen], payloadLen);
+    *t_us = injectedTime_us_;
+    if (info != 0) {
+        *info = injectedInfo_;
+    }
+    injected_.clear();
+    return (int)payloadLen;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::DecodeAvailable
+// -------------------------------------------------------------------------------------------------
+int FtdiHal::DecodeAvailable(void) {
     int nMsg = ReadBytesToDevice();
 
-    if (nMsg) {
+    // The decoder recovers from overflows itself, negative is only a setup error
+    if (nMsg > 0) {
+        nMsg = ParseShtpHeaders(nMsg);
         nRemainMsg_ = nMsg;
-        pNextMsg_ = decodeBuf_;
+        nextSpan_ = 0;
         lastSampleTime_us_ = (uint32_t)timer_->getTimestamp_us();
+        if (!sinks_.empty()) {
+            FeedReportSinks(nMsg);
+        }
     }
+    if (replayPending_) {
+        ReplayJournal();
+    }
+
+    return nMsg;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::FeedReportSinks
+// -------------------------------------------------------------------------------------------------
+// Split the freshly decoded messages into sensor reports for the sinks. Walks reports the same
+// way as the report filter: a report of unknown length ends the walk of its message.
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::FeedReportSinks(int nMsg) {
+    for (int i = 0; i < nMsg; i++) {
+        const ShtpMsgInfo_t& info = msgInfo_[i];
+        if (info.channel >= SHTP_MAX_CHANNELS || info.lengthMismatch || info.continuation) {
+            continue;
+        }
+
+        const uint8_t* payload = spans_[i].data + 1 + SHTP_HEADER_LEN;
+        size_t len = spans_[i].len - 1 - SHTP_HEADER_LEN;
+
+        if (info.channel == SHTP_CHAN_GYRO_RV) {
+            // The channel carries one report type, sent without its ID
+            uint8_t report[1 + GYRO_RV_MAX_LEN];
+            if (len == 0 || len > GYRO_RV_MAX_LEN) {
+                continue;
+            }
+            report[0] = SH2_GYRO_INTEGRATED_RV;
+            memcpy(report + 1, payload, len);
+            for (size_t s = 0; s < sinks_.size(); s++) {
+                sinks_[s]->onReport(report, len + 1, lastSampleTime_us_);
+            }
+            continue;
+        }
+        if (info.channel != SHTP_CHAN_SENSOR_NORMAL && info.channel != SHTP_CHAN_SENSOR_WAKE) {
+            continue;
+        }
 
-    return GetNextMessage(pBuffer, len, t_us, stripHeaderLen);
+        while (len > 0) {
+            uint8_t id = payload[0];
+            size_t reportLen = report_len(id);
+            if (reportLen == 0 || reportLen > len) {
+                break;
+            }
+            if (id != SH2_TIMESTAMP_REBASE && id != SH2_BASE_TIMESTAMP_REF) {
+                for (size_t s = 0; s < sinks_.size(); s++) {
+                    sinks_[s]->onReport(payload, reportLen, lastSampleTime_us_);
+                }
+            }
+            payload += reportLen;
+            len -= reportLen;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHal::RouteMessages
+// -------------------------------------------------------------------------------------------------
+void FtdiHal::RouteMessages(void) {
+    // Copy out of the decode buffer, the next decode reuses it
+    while (nRemainMsg_ > 0) {
+        router_.push(spans_[nextSpan_].data, spans_[nextSpan_].len, msgInfo_[nextSpan_],
+                     lastSampleTime_us_);
+        nRemainMsg_--;
+        nextSpan_++;
+    }
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -208,18 +1070,24 @@ int FtdiHal::ReadMessage(uint8_t* pBuffer, unsigned len, uint32_t* t_us, uint8_t
 int FtdiHal::GetNextMessage(uint8_t* pBuffer,
                             unsigned len,
                             uint32_t* t_us,
-                            uint8_t stripHeaderLen) {
+                            uint8_t stripHeaderLen,
+                            ShtpMsgInfo_t* info) {
     int payloadLen = 0;
 
     if (nRemainMsg_) {
-        payloadLen = ((*(pNextMsg_ + 1) << 8) | *(pNextMsg_)) - stripHeaderLen;
-        memcpy(pBuffer, pNextMsg_ + 2 + stripHeaderLen, payloadLen);
+        const Rfc1662Span_t* msg = &spans_[nextSpan_];
+        payloadLen = (int)msg->len - stripHeaderLen;
+        if (payloadLen > (int)len) {
+            payloadLen = (int)len; // Truncate, like ChannelRouter::pop
+        }
+        memcpy(pBuffer, msg->data + stripHeaderLen, payloadLen);
         *t_us = lastSampleTime_us_;
+        if (info != 0) {
+            *info = msgInfo_[nextSpan_];
+        }
 
         nRemainMsg_--;
-        if (nRemainMsg_) {
-            pNextMsg_ += (2 + stripHeaderLen + payloadLen);
-        }
+        nextSpan_++;
     }
 #if TRACE_IO
     if (payloadLen > 0) {
@@ -229,3 +1097,95 @@ int FtdiHal::GetNextMessage(uint8_t* pBuffer,
 #endif
     return payloadLen;
 }
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// shtp_header_info
+// -------------------------------------------------------------------------------------------------
+// Fields of a decoded message's SHTP header. Returns false, with channel 0xFF, if the message
+// isn't SHTP.
+static bool shtp_header_info(const uint8_t* msg, size_t len, ShtpMsgInfo_t* info) {
+    if (len < 1 + SHTP_HEADER_LEN || msg[0] != SHTP_UART_HEADER) {
+        memset(info, 0, sizeof(*info));
+        info->channel = 0xFF;
+        return false;
+    }
+
+    uint16_t lenField = msg[1] | (msg[2] << 8);
+    info->length = lenField & ~SHTP_CONTINUATION;
+    info->continuation = (lenField & SHTP_CONTINUATION) != 0;
+    info->channel = msg[3];
+    info->seq = msg[4];
+    info->lengthMismatch = (info->length != len - 1);
+    info->lost = 0;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// report_len
+// -------------------------------------------------------------------------------------------------
+// Length of the sensor hub reports that appear on the report channels, 0 if not known here
+static size_t report_len(uint8_t reportId) {
+    switch (reportId) {
+        case SH2_TIMESTAMP_REBASE:
+        case SH2_BASE_TIMESTAMP_REF:
+        case 0x10: // Tap detector
+            return 5;
+        case 0x0C: // Humidity
+        case 0x0D: // Proximity
+        case 0x0E: // Temperature
+        case 0x12: // Significant motion
+        case 0x13: // Stability classifier
+            return 6;
+        case 0x0A: // Pressure
+        case 0x0B: // Ambient light
+            return 8;
+        case 0x01: // Accelerometer
+        case 0x02: // Gyroscope calibrated
+        case 0x03: // Magnetic field calibrated
+        case 0x04: // Linear acceleration
+        case 0x06: // Gravity
+            return 10;
+        case 0x08: // Game rotation vector
+        case 0x11: // Step counter
+        case 0x29: // AR/VR stabilized game rotation vector
+            return 12;
+        case 0x05: // Rotation vector
+        case 0x09: // Geomagnetic rotation vector
+        case 0x28: // AR/VR stabilized rotation vector
+            return 14;
+        case 0x07: // Gyroscope uncalibrated
+        case 0x0F: // Magnetic field uncalibrated
+        case 0x14: // Raw accelerometer
+        case 0x15: // Raw gyroscope
+        case 0x16: // Raw magnetometer
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// reports_wanted
+// -------------------------------------------------------------------------------------------------
+// Walks the reports of a message payload. Fails open: a report of unknown length, or one cut
+// short, stops the walk and keeps the message rather than risk dropping something wanted.
+static bool reports_wanted(const uint8_t* payload, size_t len, const uint32_t reportIds[8]) {
+    while (len > 0) {
+        uint8_t id = payload[0];
+        size_t reportLen = report_len(id);
+        if (reportLen == 0 || reportLen > len) {
+            return true;
+        }
+        // Timestamp records only qualify the reports after them
+        if (id != SH2_TIMESTAMP_REBASE && id != SH2_BASE_TIMESTAMP_REF &&
+            (reportIds[id >> 5] & (1u << (id & 31)))) {
+            return true;
+        }
+        payload += reportLen;
+        len -= reportLen;
+    }
+    return false;
+}
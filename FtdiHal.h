@@ -24,20 +24,78 @@
 #include "WinTypes.h"
 #endif
 
+#include "ChannelRouter.h"
+#include "ConfigJournal.h"
+#include "FrameCache.h"
 #include "Rfc1662Framer.h"
+#include "ReportSink.h"
+#include "RtProfile.h"
+#include "ShtpInfo.h"
+
+#include <string.h>
+#include <vector>
 
 // =================================================================================================
 // DATA TYPES
 // =================================================================================================
 class TimerSrv;
 
+// Where the last open went, see FtdiHal::getOpenTiming. Phases a platform doesn't have stay 0.
+typedef struct OpenTiming_s {
+    uint32_t configure_us; // Open the port and set the line parameters
+    uint32_t flush_us;     // Drop stale bytes in the driver
+    uint32_t calibrate_us; // TX pacing calibration, if enabled
+    uint32_t reset_us;     // Send the soft reset, or find the hub already streaming
+    uint32_t advert_us;    // Wait for the advertisement (openWithDeadline only)
+    uint32_t total_us;
+    bool warm;             // The hub was found streaming and not reset, see setWarmAttach
+} OpenTiming_t;
+
+// Sensor configuration replay accounting, see FtdiHal::setConfigJournal
+typedef struct ConfigJournalStats_s {
+    uint32_t entries;          // Sensors with a configuration journaled
+    uint32_t hubResets;        // Hub resets the host didn't ask for
+    uint32_t replays;          // Journal replays sent
+    uint32_t commandsReplayed; // Set Feature commands sent by replays
+    uint32_t lastReplay_us;    // Reset seen to replay written, last replay
+} ConfigJournalStats_t;
+
 // =================================================================================================
 // CLASS DEFINITON - FtdiHal
 // =================================================================================================
 class FtdiHal {
 public:
-    explicit FtdiHal() : deviceIdx_(0){};
-    virtual ~FtdiHal(){};
+    explicit FtdiHal()
+        : deviceIdx_(0)
+        , decodeBuf_(0)
+        , decodeBufLen_(0)
+        , spans_(0)
+        , msgInfo_(0)
+        , maxSpans_(0)
+        , inPlaceDecode_(false)
+        , routing_(false)
+        , txChunkLen_(1)
+        , txGapUs_(0)
+        , calibrateTx_(false)
+        , filteredChannels_(0)
+        , openStart_us_(0)
+        , openMark_us_(0)
+        , openDeadline_us_(0)
+        , journalEnabled_(false)
+        , resetExpected_(false)
+        , resetRequested_us_(0)
+        , sawAdvert_(false)
+        , replayPending_(false)
+        , resetSeen_us_(0)
+        , warmAttach_(false)
+        , warmProbeUs_(0)
+        , injectedTime_us_(0) {
+        serial_[0] = 0;
+        memset(&openTiming_, 0, sizeof(openTiming_));
+        memset(&journalStats_, 0, sizeof(journalStats_));
+        ResetShtpTracking();
+    };
+    virtual ~FtdiHal();
 
     /**
     * @brief Initialize the FTDI HAL
@@ -53,6 +111,15 @@ public:
 
     virtual int open();
 
+    // open(), then wait for the hub's advertisement, all within timeout_us. Returns 0 as soon
+    // as the advertisement is decoded; it stays queued for the first read(). Messages decoded
+    // ahead of it predate the reset and are dropped. Returns -1 if open() failed, -2 if the
+    // deadline passed first (the port is left open, the advertisement may still arrive).
+    virtual int openWithDeadline(uint32_t timeout_us);
+
+    // Per phase time of the last open() or openWithDeadline()
+    virtual void getOpenTiming(OpenTiming_t* timing);
+
     virtual void close();
 
     virtual int read(uint8_t* pBuffer, unsigned len, uint32_t* t_us);
@@ -63,31 +130,229 @@ public:
     virtual int writeData(uint8_t* pBuffer, unsigned len);
     virtual int readData(uint8_t* pBuffer, unsigned len, uint32_t* t_us);
 
+    // read() that also returns the SHTP header fields of the message
+    virtual int readWithInfo(uint8_t* pBuffer, unsigned len, uint32_t* t_us, ShtpMsgInfo_t* info);
+
+    // Message, sequence gap and length mismatch counts per SHTP channel since open
+    virtual void getShtpStats(ShtpChannelStats_t stats[SHTP_MAX_CHANNELS]);
+
+    // Queue decoded messages per SHTP channel and serve them by channel priority instead of in
+    // arrival order. Messages already decoded are queued on enable, dropped on disable.
+    virtual void setChannelRouting(bool enable);
+
+    // Capacity and priority of a channel's queue (ChannelRouter::OTHER for non-SHTP messages).
+    // Command, executable and control channels default ahead of the sensor channels.
+    virtual int setChannelQueue(unsigned channel, unsigned depth, int priority);
+
+    // read() restricted to one channel. Messages of other channels stay queued.
+    // Requires channel routing. Returns 0 if the channel has nothing, negative on error.
+    virtual int readChannel(unsigned channel,
+                            uint8_t* pBuffer,
+                            unsigned len,
+                            uint32_t* t_us,
+                            ShtpMsgInfo_t* info = 0);
+
+    // Occupancy and drops of a channel's queue since open
+    virtual void getChannelQueueStats(unsigned channel, ChannelQueueStats_t* stats);
+
+    // Deliver only messages on the channel that carry at least one of the given report IDs, a
+    // 256 bit set (bit id % 32 of reportIds[id / 32]). Others are dropped as soon as they are
+    // decoded and counted in ShtpChannelStats_t::filtered. Messages holding a report this HAL
+    // doesn't know the length of are always delivered.
+    virtual int setReportFilter(unsigned channel, const uint32_t reportIds[8]);
+
+    // Deliver everything on the channel again
+    virtual void clearReportFilter(unsigned channel);
+
+    // Let open() skip the soft reset when the hub is already running, e.g. after this process
+    // restarts. If valid frames arrive within probe_us and an advertisement from this device
+    // (by serial number, see DeviceCache) is cached, the cached advertisement is queued as the
+    // first message instead and the hub keeps its configuration. Advertisements are cached as
+    // they are received while this is enabled.
+    virtual void setWarmAttach(bool enable, uint32_t probe_us = 50000);
+
+    // Hand every sensor report to sink as it is decoded, on the reading thread, in addition to
+    // queueing the message for read(). Reports on the gyro integrated rotation vector channel
+    // get their report ID (0x2A) put in front. Add and remove sinks from the reading thread or
+    // before reading starts.
+    virtual void addReportSink(ReportSink* sink);
+    virtual void removeReportSink(ReportSink* sink);
+
+    // Keep the last Set Feature command sent for each sensor, and replay them all as one paced
+    // burst as soon as the hub is seen to reset on its own (watchdog, brown-out): on the
+    // advertisement or reset complete message it sends. Resets the host asks for, through
+    // softreset() or an sh2 reset command, are left to the application.
+    virtual void setConfigJournal(bool enable);
+    virtual void clearConfigJournal(void);
+    virtual void getConfigJournalStats(ConfigJournalStats_t* stats);
+
+    /**
+    * @brief Set how encoded frames are paced out to the hub.
+    *
+    * @param  chunkLen Number of bytes handed to the device per write.
+    * @param  gap_us Delay before each write (Rpi only).
+    */
+    virtual void setTxPacing(unsigned chunkLen, unsigned gap_us);
+    virtual void getTxPacing(unsigned* chunkLen, unsigned* gap_us);
+
+    /**
+    * @brief Calibrate TX pacing against the hub during open().
+    *
+    * Bursts of Get Feature requests are sent with increasingly aggressive pacing until the hub
+    * stops answering all of them. The fastest pacing that got every answer is used and cached
+    * under the device serial number (see DeviceCache), so later opens skip the calibration.
+    */
+    virtual void setTxCalibration(bool enable);
+
+    /**
+    * @brief Apply a real-time execution profile to the calling thread.
+    *
+    * The profile is also kept for threads the HAL creates itself. With perDeviceCpu set the
+    * thread is pinned to the CPU chosen for this device index. HAL buffers are prefaulted.
+    * @return 0 if every setting was applied, -1 otherwise (details on stderr)
+    */
+    virtual int setRtProfile(const RtProfile& profile, unsigned* failed = 0);
+
+    const RtProfile& rtProfile() const {
+        return rtProfile_;
+    }
+
+    // Index given to init(), picks this device's CPU under RtProfile::perDeviceCpu
+    int deviceIdx() const {
+        return deviceIdx_;
+    }
+
+    /**
+    * @brief Cache the byte stuffed payload of commands sent with write().
+    *
+    * Repeated commands are then framed from the stuffed SHTP header and the cached payload
+    * instead of being encoded again. Not used while an FCS is enabled.
+    * @param  entries Number of distinct payloads kept, 0 disables the cache. Default 16.
+    */
+    virtual void setTxFrameCache(unsigned entries);
+    virtual void getTxFrameCacheStats(uint32_t* hits, uint32_t* misses);
+
+    // Frame check sequence on both directions. Only for bridges configured to match; frames
+    // that fail the check are dropped before they reach sh2 and counted in getRxStats.
+    virtual void setFcs(Rfc1662Framer::Fcs_e fcs);
+
+    // Frames decoded, aborted, lost to decode buffer overflow or failing the FCS since open
+    virtual void getRxStats(Rfc1662Stats_t* stats);
+
+    // Serial number of the attached device, empty if unknown
+    const char* serial() const {
+        return serial_;
+    }
+
 
 protected:
     int deviceIdx_;
     TimerSrv* timer_;
     Rfc1662Framer framer_;
 
-    uint8_t decodeBuf_[1024 + 512]; // TODO Adjust the buffer size
-    uint8_t nRemainMsg_;
-    uint8_t* pNextMsg_;
+    uint8_t* decodeBuf_;
+    size_t decodeBufLen_;
+    Rfc1662Span_t* spans_; // Messages from the last decode
+    ShtpMsgInfo_t* msgInfo_; // SHTP headers of the messages in spans_
+    size_t maxSpans_;
+    bool inPlaceDecode_;   // Encoded bytes are read into decodeBuf_ and unstuffed there
+    bool routing_;         // Decoded messages go through router_
+    ChannelRouter router_;
+    int nRemainMsg_;
+    int nextSpan_;
     uint32_t lastSampleTime_us_;
     uint8_t bridgeHostInterfaceId_;
 
-    virtual int ReadMessage(uint8_t* pBuffer, unsigned len, uint32_t* t_us, uint8_t stripHeaderLen);
-    virtual int GetNextMessage(uint8_t* pBuffer, unsigned len, uint32_t* t_us, uint8_t stripHeaderLen);
+    DWORD txChunkLen_;
+    DWORD txGapUs_;
+    bool calibrateTx_;
+    char serial_[64];
+    RtProfile rtProfile_;
+    int16_t shtpNextSeq_[SHTP_MAX_CHANNELS]; // Expected sequence number, -1 until one is seen
+    ShtpChannelStats_t shtpStats_[SHTP_MAX_CHANNELS];
+    uint32_t reportFilter_[SHTP_MAX_CHANNELS][8];
+    uint8_t filteredChannels_; // Bit per channel with a report filter set
+    OpenTiming_t openTiming_;
+    uint64_t openStart_us_;
+    uint64_t openMark_us_;     // End of the last phase timed
+    uint64_t openDeadline_us_; // 0 when open() isn't running under openWithDeadline()
+    bool journalEnabled_;
+    ConfigJournal journal_;
+    bool resetExpected_;         // The host asked for a reset, its advertisement isn't news
+    uint64_t resetRequested_us_;
+    bool sawAdvert_;             // Advertisement seen, its reset complete message is the same reset
+    bool replayPending_;
+    uint64_t resetSeen_us_;
+    ConfigJournalStats_t journalStats_;
+    std::vector<uint8_t> replayBurst_;
+    bool warmAttach_;
+    uint32_t warmProbeUs_;
+    std::vector<uint8_t> injected_; // Message read() returns before anything else, if any
+    ShtpMsgInfo_t injectedInfo_;
+    uint32_t injectedTime_us_;
+    std::vector<ReportSink*> sinks_;
+    FrameCache txCache_;
+    std::vector<uint8_t> txFrame_; // Frames assembled from txCache_
+
+    virtual int ReadMessage(uint8_t* pBuffer,
+                            unsigned len,
+                            uint32_t* t_us,
+                            uint8_t stripHeaderLen,
+                            ShtpMsgInfo_t* info = 0);
+    virtual int GetNextMessage(uint8_t* pBuffer,
+                               unsigned len,
+                               uint32_t* t_us,
+                               uint8_t stripHeaderLen,
+                               ShtpMsgInfo_t* info = 0);
+    // Open phase timing: start, then mark the end of each phase. A phase marked twice adds up.
+    void StartOpenTiming(void);
+    void MarkOpenPhase(uint32_t* phase);
+    bool OpenExpired(void);
+    bool KeepFromAdvert(void);
+
+    void ExpectReset(void);
+    void HubResetSeen(bool advert);
+    void ReplayJournal(void);
+    bool TryWarmAttach(void);
+    int PopInjected(uint8_t* pBuffer,
+                    unsigned len,
+                    uint32_t* t_us,
+                    uint8_t stripHeaderLen,
+                    ShtpMsgInfo_t* info);
+
+    // true if read() has a message to return without reading the device
+    bool MessagesQueued(void) const;
+
+    virtual int DecodeAvailable(void);
+    virtual int ParseShtpHeaders(int nMsg);
+    virtual void RouteMessages(void);
+    void FeedReportSinks(int nMsg);
+    void ResetShtpTracking(void);
+    void ResetShtpSeq(void);
 
     virtual int ReadBytesToDevice(void) = 0;
 
+    // Size the decode buffer for reads of up to maxRead bytes. Drops anything buffered.
+    int SetDecodeBufLen(size_t maxRead);
+    // Start decoding from scratch in the configured mode. Drops anything buffered.
+    void ResetDecoder(void);
+
     
     virtual void WriteEncodedFrame(UCHAR* bytes, DWORD length);
+    virtual bool WriteCached(const uint8_t* pBuffer, unsigned len);
+    virtual int CalibrateTxPacing(void);
+    virtual void PrefaultBuffers(void);
     virtual BOOL WriteBytesToDevice(LPVOID lpBuffer,
                                     DWORD nNumberOfBytesToWrite,
                                     LPDWORD lpNumberOfBytesWritten) = 0;
 
     // Helper Function
     virtual void PrintBytes(uint8_t* bytes, DWORD len);
+
+private:
+    // Not copyable, owns the decode buffers
+    FtdiHal(const FtdiHal&);
+    FtdiHal& operator=(const FtdiHal&);
 };
 
 #endif // FTDI_HAL_H
@@ -16,6 +16,7 @@
  */
 
 #include "FtdiHalRpi.h"
+#include "HubManager.h"
 #include "ftd2xx.h"
 #include "Rfc1662Framer.h"
 #include "TimerService.h"
@@ -25,15 +26,24 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <sys/time.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
 #define DEBUG_BUFFER 0
 #define USE_SELECT
 #define PPP_FLAG 0x7E
-#define BYTE_TX_MIN_SPACE_US 200
+#define BYTE_TX_MIN_SPACE_US 200 // Default TX pacing, see FtdiHal::setTxCalibration
+#define RX_TIMEOUT_US 10000
+#define MIN_READ_SIZE 256
+#define READ_SIZE_STEP 64
 
 
 // =================================================================================================
@@ -63,6 +73,21 @@ void uart_errno_printf(const char* s, ...) {
 
 int uart_rpi_read(uint8_t* buf, uint32_t buffer_size);
 
+// Find the tty currently carrying a USB serial number, whatever the vendor
+static bool find_tty_by_serial(const char* serial, char* devicePath, size_t len) {
+    std::vector<HubInfo_t> usb;
+    if (HubManager::discover(&usb, 0) < 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < usb.size(); i++) {
+        if (strcmp(usb[i].serial, serial) == 0 && strlen(usb[i].devicePath) < len) {
+            strcpy(devicePath, usb[i].devicePath);
+            return true;
+        }
+    }
+    return false;
+}
 
 // =================================================================================================
 // PUBLIC FUNCTIONS - FtdiHalRpi
@@ -76,11 +101,21 @@ int FtdiHalRpi::open() {
     struct termios tty;
     speed_t baud = B3000000;
 
+    StartOpenTiming();
+    if (AllocBuffers() < 0) {
+        return -1;
+    }
+    readEwma_ = 0;
+    lastWaiting_ = 0;
+
     // we dont know how many bytes to read. blocked by interrupt poll
     if ((deviceDescriptor_ = ::open(device_, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
         uart_errno_printf("uart_connect: OPEN %s:", device_);
         return -1;
     }
+    if (epollFd_ >= 0) {
+        WatchDevice(true);
+    }
     
     if (tcgetattr(deviceDescriptor_, &tty) < 0) {
         fprintf(stderr, "unable to read port attributes");
@@ -105,6 +140,8 @@ int FtdiHalRpi::open() {
         return -1;
     }
 
+    MarkOpenPhase(&openTiming_.configure_us);
+
     fsync(deviceDescriptor_);
 
     if (tcflush(deviceDescriptor_, TCIOFLUSH) == 0) {
@@ -113,8 +150,46 @@ int FtdiHalRpi::open() {
         // printf("QUESTION! \n");
     }
 
-    // Issue Soft reset which triggers SensorHub to send the advertise response
-    softreset();
+    MarkOpenPhase(&openTiming_.flush_us);
+
+    HubInfo_t usb;
+    if (HubManager::describe(device_, &usb)) {
+        snprintf(serial_, sizeof(serial_), "%s", usb.serial);
+    } else {
+        serial_[0] = 0;
+    }
+
+    // Line stats count from here; the driver's counters live as long as the port
+    memset(&lineStats_, 0, sizeof(lineStats_));
+    lineStats_.icountValid = ReadIcount(icountBase_);
+    framer_.resetStats();
+    ResetShtpTracking();
+    router_.resetStats();
+
+    if (useIoUring_) {
+        int err = inPlaceDecode_ ? uring_.init(deviceDescriptor_, decodeBuf_, decodeBufLen_)
+                                 : uring_.init(deviceDescriptor_, rxBuffer_, rxBufferLen_);
+        if (err < 0) {
+            fprintf(stderr, "io_uring unavailable (%s), using select\n", strerror(-err));
+        }
+    }
+    MarkOpenPhase(&openTiming_.configure_us);
+
+    if (calibrateTx_) {
+        CalibrateTxPacing();
+        MarkOpenPhase(&openTiming_.calibrate_us);
+    }
+    if (OpenExpired()) {
+        return -2;
+    }
+
+    // Issue Soft reset which triggers SensorHub to send the advertise response, unless the hub
+    // is already running and can be picked up as it is
+    if (!TryWarmAttach()) {
+        softreset();
+    }
+    MarkOpenPhase(&openTiming_.reset_us);
+    UpdatePollEvents();
 
     return 0;
 }
@@ -123,30 +198,501 @@ int FtdiHalRpi::open() {
 // FtdiHalRpi::close
 // -------------------------------------------------------------------------------------------------
 void FtdiHalRpi::close() {
+    if (epollFd_ >= 0 && deviceDescriptor_ >= 0) {
+        WatchDevice(false);
+    }
+    uring_.close();
     ::close(deviceDescriptor_);
+    deviceDescriptor_ = -1;
 }
 
 // -------------------------------------------------------------------------------------------------
 // FtdiHalRpi::init
 // -------------------------------------------------------------------------------------------------
 int FtdiHalRpi::init(int deviceIdx, TimerSrv* timer) {
-    static char device[15];
-    snprintf(device, 15, "/dev/ttyUSB%d", deviceIdx);
-    device_ = device;
+    snprintf(device_, sizeof(device_), "/dev/ttyUSB%d", deviceIdx);
     deviceDescriptor_ = -1;
+    setTxPacing(1, BYTE_TX_MIN_SPACE_US);
     return FtdiHal::init(deviceIdx, timer);
 }
 
 int FtdiHalRpi::init(const char * device, TimerSrv* timer) {
+    return init(device, 0, timer);
+}
+
+int FtdiHalRpi::init(const char* device, int deviceIdx, TimerSrv* timer) {
+
+    if (strlen(device) >= sizeof(device_)) {
+        fprintf(stderr, "Device path too long: %s\n", device);
+        return -1;
+    }
+    strcpy(device_, device);
+    deviceDescriptor_ = -1;
+    setTxPacing(1, BYTE_TX_MIN_SPACE_US);
+    return FtdiHal::init(deviceIdx, timer);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::setIoUring
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::setIoUring(bool enable) {
+    useIoUring_ = enable;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::setBusyPoll
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::setBusyPoll(uint32_t budget_us) {
+    busyPollUs_ = budget_us;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::setReadSizing
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::setReadSizing(uint32_t maxRead, uint32_t drainThreshold) {
+    maxRead_ = (maxRead < MIN_READ_SIZE) ? MIN_READ_SIZE : maxRead;
+    drainThreshold_ = drainThreshold;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::setInPlaceDecode
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::setInPlaceDecode(bool enable) {
+    inPlaceDecode_ = enable;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::setAutoReconnect
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::setAutoReconnect(bool enable, uint32_t poll_us, ReconnectCb_t* cb, void* cookie) {
+    autoReconnect_ = enable;
+    reconnectPollUs_ = poll_us;
+    reconnectCb_ = cb;
+    reconnectCookie_ = cookie;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::getReconnectStats
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::getReconnectStats(ReconnectStats_t* stats) {
+    *stats = reconnectStats_;
+    stats->connected = !lost_ && deviceDescriptor_ > 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::getBusyPollStats
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::getBusyPollStats(BusyPollStats_t* stats) {
+    *stats = busyPollStats_;
+}
+
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::getLineStats
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::getLineStats(LineStats_t* stats) {
+    uint32_t counts[5];
+
+    if (deviceDescriptor_ <= 0) {
+        return -1;
+    }
+
+    *stats = lineStats_;
+    if (lineStats_.icountValid && ReadIcount(counts)) {
+        stats->overrun = counts[0] - icountBase_[0];
+        stats->frame = counts[1] - icountBase_[1];
+        stats->parity = counts[2] - icountBase_[2];
+        stats->brk = counts[3] - icountBase_[3];
+        stats->bufOverrun = counts[4] - icountBase_[4];
+    } else {
+        stats->icountValid = false;
+    }
+    framer_.getStats(&stats->decoder);
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::pollFd
+// -------------------------------------------------------------------------------------------------
+// An epoll set holding the tty, an eventfd raised while decoded messages wait in the HAL and a
+// timerfd that paces reconnect attempts. An epoll fd is itself pollable, so callers see a
+// single descriptor however the readiness sources change underneath (reopen, reconnect).
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::pollFd(void) {
+    if (epollFd_ >= 0) {
+        return epollFd_;
+    }
+
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epollFd_ < 0 || eventFd_ < 0 || timerFd_ < 0) {
+        uart_errno_printf("pollFd: unable to create descriptors");
+        ClosePollFds();
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, eventFd_, &ev) < 0 ||
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd_, &ev) < 0) {
+        uart_errno_printf("pollFd: epoll_ctl");
+        ClosePollFds();
+        return -1;
+    }
+
+    queuedSignalled_ = false;
+    if (deviceDescriptor_ >= 0) {
+        WatchDevice(true);
+    }
+    if (lost_) {
+        ArmReconnectTimer(true);
+    }
+    UpdatePollEvents();
+    return epollFd_;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::service
+// -------------------------------------------------------------------------------------------------
+// One pass of the receive path without blocking: a single read of what the tty holds (no select
+// wait, the caller's loop already waited on pollFd()), then every complete message queued in
+// the HAL goes to cb. Bytes of a partial frame stay in the decoder for the next pass. While the
+// device is lost the pass tries a reconnect instead, which blocks for open() if it succeeds.
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::service(ServiceCb_t* cb, void* cookie) {
+    if (deviceDescriptor_ < 0 && !lost_) {
+        return -1;
+    }
+    if (timerFd_ >= 0) {
+        uint64_t expirations;
+        if (::read(timerFd_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+            uart_errno_printf("service: timerfd read");
+        }
+    }
+    if (serviceBuf_.size() < decodeBufLen_) {
+        serviceBuf_.resize(decodeBufLen_);
+    }
 
-    device_ = device;
-    return FtdiHal::init(0, timer);
+    int delivered = 0;
+    uint32_t t_us = 0;
+    int len;
+
+    serviceReads_ = 1;
+    while ((len = FtdiHal::ReadMessage(&serviceBuf_[0], (unsigned)serviceBuf_.size(), &t_us, 1)) > 0) {
+        if (cb != 0) {
+            cb(cookie, &serviceBuf_[0], (unsigned)len, t_us);
+        }
+        delivered++;
+    }
+    serviceReads_ = -1;
+
+    UpdatePollEvents();
+    return delivered;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::readChannel
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::readChannel(unsigned channel,
+                            uint8_t* pBuffer,
+                            unsigned len,
+                            uint32_t* t_us,
+                            ShtpMsgInfo_t* info) {
+    int rc = FtdiHal::readChannel(channel, pBuffer, len, t_us, info);
+    UpdatePollEvents();
+    return rc;
 }
 
 
 // =================================================================================================
 // PRIVATE FUNCTIONS
 // =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::ReadMessage
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::ReadMessage(uint8_t* pBuffer,
+                            unsigned len,
+                            uint32_t* t_us,
+                            uint8_t stripHeaderLen,
+                            ShtpMsgInfo_t* info) {
+    int rc = FtdiHal::ReadMessage(pBuffer, len, t_us, stripHeaderLen, info);
+    UpdatePollEvents();
+    return rc;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::DecodeAvailable
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::DecodeAvailable(void) {
+    int nMsg = FtdiHal::DecodeAvailable();
+    UpdatePollEvents();
+    return nMsg;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::UpdatePollEvents
+// -------------------------------------------------------------------------------------------------
+// Keep the eventfd readable exactly while messages wait in the HAL. Only touches it when that
+// changes, so reads pay no syscall in the steady state.
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::UpdatePollEvents(void) {
+    if (eventFd_ < 0) {
+        return;
+    }
+
+    bool queued = MessagesQueued();
+    if (queued == queuedSignalled_) {
+        return;
+    }
+
+    uint64_t v = 1;
+    ssize_t rc = queued ? ::write(eventFd_, &v, sizeof(v)) : ::read(eventFd_, &v, sizeof(v));
+    if (rc < 0 && errno != EAGAIN) {
+        uart_errno_printf("eventfd");
+        return;
+    }
+    queuedSignalled_ = queued;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::WatchDevice
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::WatchDevice(bool watch) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+
+    if (epoll_ctl(epollFd_, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, deviceDescriptor_, &ev) < 0) {
+        uart_errno_printf("epoll_ctl %s %s:", watch ? "add" : "del", device_);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::ArmReconnectTimer
+// -------------------------------------------------------------------------------------------------
+// While the device is gone there is no tty to wake the caller's loop; tick every
+// reconnectPollUs_ instead so service() gets to try the reopen.
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::ArmReconnectTimer(bool arm) {
+    if (timerFd_ < 0) {
+        return;
+    }
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (arm) {
+        its.it_interval.tv_sec = reconnectPollUs_ / 1000000;
+        its.it_interval.tv_nsec = (long)(reconnectPollUs_ % 1000000) * 1000;
+        its.it_value = its.it_interval;
+    }
+    if (timerfd_settime(timerFd_, 0, &its, NULL) < 0) {
+        uart_errno_printf("timerfd_settime");
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::ClosePollFds
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::ClosePollFds(void) {
+    if (epollFd_ >= 0) {
+        ::close(epollFd_);
+    }
+    if (eventFd_ >= 0) {
+        ::close(eventFd_);
+    }
+    if (timerFd_ >= 0) {
+        ::close(timerFd_);
+    }
+    epollFd_ = -1;
+    eventFd_ = -1;
+    timerFd_ = -1;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::DeviceLost
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::DeviceLost(int err) {
+    fprintf(stderr, "%s lost: %s\n", device_, strerror(-err));
+    close();
+    if (reconnecting_) {
+        // Dropped again while TryReconnect() was reopening it, that attempt fails
+        lost_ = true;
+        return;
+    }
+    reconnectStats_.disconnects++;
+    if (!autoReconnect_) {
+        return;
+    }
+
+    lost_ = true;
+    lostAt_us_ = timer_->getTimestamp_us();
+    lastAttempt_us_ = 0;
+    ArmReconnectTimer(true);
+    if (reconnectCb_ != 0) {
+        reconnectCb_(reconnectCookie_, false, &reconnectStats_);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::TryReconnect
+// -------------------------------------------------------------------------------------------------
+// Called in place of a read while the device is gone. Looks for it every reconnectPollUs_ and
+// reopens it with the settings in effect: the same tty, or whichever tty now carries the same
+// USB serial number, since the node name can change on replug. Always returns 0 messages.
+// open() reads the device itself (TX calibration, warm attach probe), so lost_ is cleared for
+// the duration and those reads block as in a plain open(), also when called from service().
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::TryReconnect(void) {
+    uint64_t now = timer_->getTimestamp_us();
+
+    if (serviceReads_ >= 0) {
+        // From service(): the reconnect timer already paced this, so don't sleep. The reopen
+        // below still blocks for open(), as documented for service().
+    } else if (lastAttempt_us_ != 0 && now - lastAttempt_us_ < reconnectPollUs_) {
+        // Stand in for the read timeout, callers poll read() in a loop
+        uint64_t wait = reconnectPollUs_ - (now - lastAttempt_us_);
+        usleep((useconds_t)((wait < RX_TIMEOUT_US) ? wait : RX_TIMEOUT_US));
+        return 0;
+    }
+    lastAttempt_us_ = now;
+
+    char path[FTDI_HAL_DEVICE_PATH_LEN];
+    if (serial_[0] != 0 && find_tty_by_serial(serial_, path, sizeof(path))) {
+        strcpy(device_, path);
+    } else if (access(device_, F_OK) != 0) {
+        return 0;
+    }
+
+    reconnectStats_.attempts++;
+    int serviceReads = serviceReads_;
+    lost_ = false;
+    reconnecting_ = true;
+    serviceReads_ = -1;
+    int rc = open();
+    serviceReads_ = serviceReads;
+    reconnecting_ = false;
+    if (rc != 0 || lost_) {
+        close();
+        lost_ = true;
+        return 0;
+    }
+
+    uint64_t downtime = timer_->getTimestamp_us() - lostAt_us_;
+    ArmReconnectTimer(false);
+    reconnectStats_.reconnects++;
+    reconnectStats_.lastDowntime_us = (uint32_t)downtime;
+    reconnectStats_.totalDowntime_us += downtime;
+    if (downtime > reconnectStats_.maxDowntime_us) {
+        reconnectStats_.maxDowntime_us = (uint32_t)downtime;
+    }
+    fprintf(stderr, "%s reconnected after %u us\n", device_, (unsigned)downtime);
+
+    if (reconnectCb_ != 0) {
+        reconnectCb_(reconnectCookie_, true, &reconnectStats_);
+    }
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::ReadIcount
+// -------------------------------------------------------------------------------------------------
+// Not every tty supports TIOCGICOUNT (ptys don't), returns false in that case
+// -------------------------------------------------------------------------------------------------
+bool FtdiHalRpi::ReadIcount(uint32_t counts[5]) {
+    struct serial_icounter_struct icount;
+
+    memset(&icount, 0, sizeof(icount));
+    if (ioctl(deviceDescriptor_, TIOCGICOUNT, &icount) < 0) {
+        return false;
+    }
+
+    counts[0] = icount.overrun;
+    counts[1] = icount.frame;
+    counts[2] = icount.parity;
+    counts[3] = icount.brk;
+    counts[4] = icount.buf_overrun;
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::AllocBuffers
+// -------------------------------------------------------------------------------------------------
+// Sizes the buffers for maxRead_. Decoding in place needs no RX buffer of its own.
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::AllocBuffers(void) {
+    if (SetDecodeBufLen(maxRead_) < 0) {
+        return -1;
+    }
+
+    if (inPlaceDecode_) {
+        free(rxBuffer_);
+        rxBuffer_ = NULL;
+        rxBufferLen_ = 0;
+    } else if (rxBufferLen_ != maxRead_) {
+        uint8_t* buf = (uint8_t*)malloc(maxRead_);
+        if (buf == NULL) {
+            fprintf(stderr, "unable to allocate %u byte RX buffer\n", maxRead_);
+            return -1;
+        }
+        free(rxBuffer_);
+        rxBuffer_ = buf;
+        rxBufferLen_ = maxRead_;
+    }
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::NextReadSize
+// -------------------------------------------------------------------------------------------------
+// Twice the usual bytes per read plus whatever was left behind last time, so a steady stream is
+// taken in one read and a growing backlog is caught up with quickly. Smaller reads keep the
+// decode work per call, and with it the delay to the first message, in proportion to the rate.
+// -------------------------------------------------------------------------------------------------
+uint32_t FtdiHalRpi::NextReadSize(void) {
+    uint32_t n;
+
+    if (drainThreshold_ > 0 && lastWaiting_ >= drainThreshold_) {
+        lineStats_.drainReads++;
+        return maxRead_;
+    }
+
+    n = 2 * readEwma_ + lastWaiting_;
+    n = (n + READ_SIZE_STEP - 1) & ~(READ_SIZE_STEP - 1);
+    if (n < MIN_READ_SIZE) {
+        n = MIN_READ_SIZE;
+    }
+    return (n > maxRead_) ? maxRead_ : n;
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::SampleRxQueue
+// -------------------------------------------------------------------------------------------------
+// The queue depth at the time of a read is what was read plus what is still waiting. Only
+// sampled after reads that returned data, so an idle link costs nothing extra.
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::SampleRxQueue(size_t bytesRead, uint32_t readSize) {
+    int waiting = 0;
+
+    lineStats_.rxBytes += bytesRead;
+    if (bytesRead == readSize) {
+        lineStats_.fullReads++;
+    }
+
+    if (ioctl(deviceDescriptor_, FIONREAD, &waiting) < 0 || waiting < 0) {
+        waiting = 0;
+    }
+    if (bytesRead + waiting > lineStats_.rxQueueHighWater) {
+        lineStats_.rxQueueHighWater = (uint32_t)(bytesRead + waiting);
+    }
+
+    readEwma_ = (7 * readEwma_ + (uint32_t)bytesRead) / 8;
+    lastWaiting_ = (uint32_t)waiting;
+}
+
 // -------------------------------------------------------------------------------------------------
 // FtdiHalRpi::WriteBytesToDevice
 // -------------------------------------------------------------------------------------------------
@@ -154,19 +700,96 @@ BOOL FtdiHalRpi::WriteBytesToDevice(LPVOID lpBuffer,
                                  DWORD nNumberOfBytesToWrite,
                                  LPDWORD lpNumberOfBytesWritten) {
 
-    usleep(BYTE_TX_MIN_SPACE_US);
-    return (::write(deviceDescriptor_, lpBuffer, 1) == 1);
+    if (txGapUs_ > 0) {
+        usleep(txGapUs_);
+    }
+    int written = ::write(deviceDescriptor_, lpBuffer, nNumberOfBytesToWrite);
+    *lpNumberOfBytesWritten = (written > 0) ? written : 0;
+    return (written == (int)nNumberOfBytesToWrite);
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::WriteEncodedFrame
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::WriteEncodedFrame(UCHAR* bytes, DWORD length) {
+    int written = -EBADF;
+
+    // Same pacing as the select path, but the whole frame is a single submission
+    if (uring_.isActive()) {
+        written = uring_.writePaced(bytes, length, txChunkLen_, txGapUs_);
+    }
+
+    if (written == -EBADF || written == -EEXIST) {
+        // No ring, or the TX ring belongs to another thread
+        FtdiHal::WriteEncodedFrame(bytes, length);
+    } else if (written != (int)length) {
+        fprintf(stderr, "WriteBytesToDevice failed!\n");
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::PrefaultBuffers
+// -------------------------------------------------------------------------------------------------
+void FtdiHalRpi::PrefaultBuffers(void) {
+    FtdiHal::PrefaultBuffers();
+    if (rxBuffer_ != NULL) {
+        RtProfile::prefault(rxBuffer_, rxBufferLen_);
+    }
 }
 
 // -------------------------------------------------------------------------------------------------
 // FtdiHalRpi::ReadBytesToDevice
 // -------------------------------------------------------------------------------------------------
 int FtdiHalRpi::ReadBytesToDevice(void) {
-    uint8_t rxBuffer[1024];
-    uint16_t MAX_READ = sizeof(rxBuffer);
-    size_t bytesRead = RpiUartRead(rxBuffer, MAX_READ);
+    if (lost_) {
+        // Lost again during a reopen: nothing to read, TryReconnect() fails that attempt
+        return reconnecting_ ? 0 : TryReconnect();
+    }
+
+    uint8_t* rxBuffer = rxBuffer_;
+    uint32_t MAX_READ = NextReadSize();
+    int rc = -EBADF;
+
+    if (inPlaceDecode_) {
+        // Read in behind the partially decoded message, if any
+        size_t space;
+        rxBuffer = framer_.decodeBuffer(&space);
+        if (space < MAX_READ) {
+            MAX_READ = (uint32_t)space;
+        }
+    }
+    lineStats_.readSize = MAX_READ;
+
+    if (serviceReads_ >= 0) {
+        // service(): one read of what is already there, the caller's loop did the waiting
+        if (serviceReads_ == 0) {
+            return 0;
+        }
+        serviceReads_--;
+        rc = RpiUartRead(rxBuffer, MAX_READ, 0);
+    } else {
+        if (busyPollUs_ > 0) {
+            rc = BusyPollRead(rxBuffer, MAX_READ);
+            if (rc == 0) {
+                rc = -EBADF; // nothing within the budget, block below
+            }
+        }
+        if (rc == -EBADF && uring_.isActive()) {
+            rc = uring_.read(MAX_READ, RX_TIMEOUT_US, inPlaceDecode_ ? rxBuffer - decodeBuf_ : 0);
+        }
+        if (rc == -EBADF || rc == -EEXIST) {
+            // No ring, or the RX ring belongs to another thread
+            rc = RpiUartRead(rxBuffer, MAX_READ, RX_TIMEOUT_US);
+        }
+    }
+    if (rc == -EIO || rc == -ENODEV || rc == -ENXIO) {
+        DeviceLost(rc);
+        return 0;
+    }
+    size_t bytesRead = rc;
 
     if ((bytesRead > 0) && (bytesRead <= MAX_READ)) {
+        SampleRxQueue(bytesRead, MAX_READ);
 
 #if TRACE_IO
         fprintf(stderr, "bytes read: ");
@@ -174,7 +797,11 @@ int FtdiHalRpi::ReadBytesToDevice(void) {
 #endif
 
         int nMsg;
-        nMsg = framer_.decode((uint8_t*)rxBuffer, bytesRead);
+        if (inPlaceDecode_) {
+            nMsg = framer_.decodeInPlace(bytesRead);
+        } else {
+            nMsg = framer_.decode((uint8_t*)rxBuffer, bytesRead);
+        }
 
         return nMsg;
         
@@ -184,10 +811,45 @@ int FtdiHalRpi::ReadBytesToDevice(void) {
 
 }
 
+// -------------------------------------------------------------------------------------------------
+// FtdiHalRpi::BusyPollRead
+// -------------------------------------------------------------------------------------------------
+// Non-blocking reads until data arrives or the spin budget runs out. Returns bytes read, 0 when
+// the budget ran out, -errno on a read error.
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::BusyPollRead(uint8_t* buf, uint32_t buffer_size) {
+    uint64_t start = timer_->getTimestamp_us();
+    uint64_t elapsed = 0;
+    int ready;
+
+    if (deviceDescriptor_ <= 0) {
+        return -1;
+    }
+
+    do {
+        ready = ::read(deviceDescriptor_, buf, buffer_size);
+        elapsed = timer_->getTimestamp_us() - start;
+        if (ready > 0) {
+            busyPollStats_.hits++;
+            busyPollStats_.spinTime_us += elapsed;
+            return ready;
+        }
+        if (ready < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -errno;
+        }
+    } while (elapsed < busyPollUs_);
+
+    busyPollStats_.misses++;
+    busyPollStats_.spinTime_us += elapsed;
+    return 0;
+}
+
 // -------------------------------------------------------------------------------------------------
 // FtdiHalRpi::RpiUartRead
 // -------------------------------------------------------------------------------------------------
-int FtdiHalRpi::RpiUartRead(uint8_t* buf, uint32_t buffer_size) {
+// Returns bytes read, 0 on timeout, -errno on error
+// -------------------------------------------------------------------------------------------------
+int FtdiHalRpi::RpiUartRead(uint8_t* buf, uint32_t buffer_size, uint32_t timeout_us) {
 
     if (deviceDescriptor_ <= 0) {
         return -1;
@@ -204,7 +866,7 @@ int FtdiHalRpi::RpiUartRead(uint8_t* buf, uint32_t buffer_size) {
     int status;
 
     timeout.tv_sec = 0;
-    timeout.tv_usec = 10000;
+    timeout.tv_usec = timeout_us;
 
     FD_ZERO(&fds);
     FD_SET(deviceDescriptor_, &fds);
@@ -215,7 +877,7 @@ int FtdiHalRpi::RpiUartRead(uint8_t* buf, uint32_t buffer_size) {
 #if DEBUG_BUFFER
         fprintf(stderr, "select errno = %d \n", errno); // (%s) , strerror(errno)
 #endif
-        return status;
+        return -errno;
 
     } else if (status == 0) {
 #if DEBUG_BUFFER
@@ -243,6 +905,13 @@ int FtdiHalRpi::RpiUartRead(uint8_t* buf, uint32_t buffer_size) {
                     PPP_FLAG,
                     buf[ready - 1]);
 #endif
+        if (ready < 0) {
+            return -errno;
+        }
+        if (ready == 0 && access(device_, F_OK) != 0) {
+            // Readable yet empty: the tty was hung up, and the node is gone with the device
+            return -ENODEV;
+        }
         return ready;
 
 #ifdef USE_SELECT
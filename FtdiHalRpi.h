@@ -19,19 +19,106 @@
 #define FTDI_HAL_RPI_H
 
 #include "FtdiHal.h"
+#include "UringTransport.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define FTDI_HAL_DEVICE_PATH_LEN 128
 
  // =================================================================================================
  // DATA TYPES
  // =================================================================================================
 class TimerSrv;
 
+// Busy-poll RX accounting, see FtdiHalRpi::setBusyPoll
+typedef struct BusyPollStats_s {
+    uint64_t spinTime_us; // Total time spent spinning
+    uint32_t hits;        // Spins that found data within the budget
+    uint32_t misses;      // Spins that ran out of budget and fell back to blocking
+} BusyPollStats_t;
+
+// Receive path accounting, see FtdiHalRpi::getLineStats. Counts are since open().
+typedef struct LineStats_s {
+    // Line errors reported by the UART driver (TIOCGICOUNT), only if icountValid
+    bool icountValid;
+    uint32_t overrun;    // Chip receive FIFO overruns
+    uint32_t frame;      // Framing errors
+    uint32_t parity;     // Parity errors
+    uint32_t brk;        // Breaks received
+    uint32_t bufOverrun; // Bytes dropped because the tty buffer was full
+
+    // Host backlog
+    uint32_t rxQueueHighWater; // Most bytes seen waiting in the tty (read + FIONREAD)
+    uint32_t fullReads;        // Reads that returned as many bytes as were asked for
+    uint32_t drainReads;       // Reads sized to the maximum to drain a backlog
+    uint32_t readSize;         // Size of the last read asked for
+    uint64_t rxBytes;          // Bytes read from the tty
+
+    // HAL decoder
+    Rfc1662Stats_t decoder;
+} LineStats_t;
+
+// Device loss and recovery accounting, see FtdiHalRpi::setAutoReconnect
+typedef struct ReconnectStats_s {
+    bool connected;
+    uint32_t disconnects;      // Device losses detected
+    uint32_t attempts;         // Reopens tried
+    uint32_t reconnects;       // Reopens that succeeded
+    uint32_t lastDowntime_us;  // Loss to reopen, last reconnect
+    uint32_t maxDowntime_us;   // Loss to reopen, worst reconnect
+    uint64_t totalDowntime_us; // Loss to reopen, all reconnects
+} ReconnectStats_t;
+
+// Called from the reading thread when the device is lost (connected false) and once it has
+// been reopened (connected true). The hub was soft reset by the reopen.
+typedef void(ReconnectCb_t)(void* cookie, bool connected, const ReconnectStats_t* stats);
+
+// Called by FtdiHalRpi::service for each message, UART header stripped as by read(). pBuffer
+// is only valid during the call.
+typedef void(ServiceCb_t)(void* cookie, uint8_t* pBuffer, unsigned len, uint32_t t_us);
+
 // =================================================================================================
 // CLASS DEFINITON - FtdiHalRpi
 // =================================================================================================
 class FtdiHalRpi : public FtdiHal {
 public:
-	explicit FtdiHalRpi() : FtdiHal() {};
-	virtual ~FtdiHalRpi() {};
+	explicit FtdiHalRpi()
+        : FtdiHal()
+        , useIoUring_(false)
+        , rxBuffer_(0)
+        , rxBufferLen_(0)
+        , maxRead_(1024)
+        , drainThreshold_(0)
+        , readEwma_(0)
+        , lastWaiting_(0)
+        , busyPollUs_(0)
+        , autoReconnect_(false)
+        , lost_(false)
+        , reconnecting_(false)
+        , reconnectPollUs_(0)
+        , lostAt_us_(0)
+        , lastAttempt_us_(0)
+        , reconnectCb_(0)
+        , reconnectCookie_(0)
+        , epollFd_(-1)
+        , eventFd_(-1)
+        , timerFd_(-1)
+        , queuedSignalled_(false)
+        , serviceReads_(-1) {
+        device_[0] = 0;
+        memset(&reconnectStats_, 0, sizeof(reconnectStats_));
+        memset(&busyPollStats_, 0, sizeof(busyPollStats_));
+        memset(&lineStats_, 0, sizeof(lineStats_));
+        memset(icountBase_, 0, sizeof(icountBase_));
+    };
+	virtual ~FtdiHalRpi() {
+        ClosePollFds();
+        free(rxBuffer_);
+    };
 
 	// inherit from FtdiHal
 	virtual int open();
@@ -39,20 +126,135 @@ public:
 	
     virtual int init(int deviceIdx, TimerSrv* timer);
     virtual int init(const char* device, TimerSrv* timer);
+    // Open device by path while still numbering it, e.g. by its slot among several hubs
+    virtual int init(const char* device, int deviceIdx, TimerSrv* timer);
+
+    // Service the tty through io_uring instead of select/read (call before open). Falls back to
+    // select/read if io_uring can't be set up on this system.
+    void setIoUring(bool enable);
+
+    // Spin on non-blocking reads for up to budget_us before blocking for RX data. Trades a busy
+    // core for the scheduler wakeup latency. 0 disables.
+    void setBusyPoll(uint32_t budget_us);
+
+    // Reads are sized from the recent bytes per read and the backlog left in the tty after the
+    // previous read, up to maxRead (call before open). When at least drainThreshold bytes are
+    // waiting, reads go straight to maxRead to empty the kernel queue in as few passes as
+    // possible. 0 disables drain mode.
+    void setReadSizing(uint32_t maxRead, uint32_t drainThreshold);
+
+    // Read straight into the decoder's buffer and unstuff there instead of staging reads in a
+    // separate RX buffer and copying them out while decoding (call before open).
+    void setInPlaceDecode(bool enable);
+    void getBusyPollStats(BusyPollStats_t* stats);
+
+    // When reads find the device gone (unplugged, USB reset), close it and, instead of failing
+    // every read, look for it every poll_us and reopen it with the same settings. The device is
+    // matched by USB serial number if it has one, so it may come back under another ttyUSB
+    // name. cb may be NULL.
+    void setAutoReconnect(bool enable,
+                          uint32_t poll_us = 50000,
+                          ReconnectCb_t* cb = 0,
+                          void* cookie = 0);
+    void getReconnectStats(ReconnectStats_t* stats);
+
+    // For event loops (epoll, libuv, asio): a descriptor that polls readable whenever service()
+    // has work, i.e. the tty has bytes, decoded messages are waiting in the HAL, or a reconnect
+    // attempt is due. Created on first call, owned by the HAL and stable across close/open and
+    // reconnects. Returns -1 if it can't be set up.
+    int pollFd(void);
+
+    // Non-blocking receive step for pollFd() users: reads what the tty holds, decodes it and
+    // hands every complete message to cb. Returns the number of messages delivered, or -1 if
+    // the device isn't open. Mixing in read()/readChannel() calls is fine; messages they leave
+    // queued keep pollFd() readable.
+    // Exception: with auto reconnect, the pass that finds the device back runs the full open()
+    // and blocks until it returns, just as a plain open() would: line setup and flush, then TX
+    // calibration if enabled (a burst per pacing step, up to 100 ms each, unless pacing for the
+    // serial number is cached), then the warm attach probe if enabled and an advertisement is
+    // cached (up to its probe_us), else a soft reset. Calibration responses are discarded; the
+    // cached advertisement and whatever the probe decoded stay queued, with pollFd() readable,
+    // for the next pass. If the device drops again meanwhile the pass gives up and a later one
+    // retries.
+    int service(ServiceCb_t* cb, void* cookie);
+
+    virtual int readChannel(unsigned channel,
+                            uint8_t* pBuffer,
+                            unsigned len,
+                            uint32_t* t_us,
+                            ShtpMsgInfo_t* info = 0);
+
+    // Line error counts from the driver alongside the host backlog and decoder counts. Tells
+    // bytes the host was too slow to take apart from bytes lost on the wire.
+    // Returns 0, or -1 if the device isn't open.
+    int getLineStats(LineStats_t* stats);
 
 protected:
-    const char* device_;
+    char device_[FTDI_HAL_DEVICE_PATH_LEN]; // Own copy, so every instance keeps its own path
 
 private:
 	virtual int ReadBytesToDevice(void);
+    virtual int ReadMessage(uint8_t* pBuffer,
+                            unsigned len,
+                            uint32_t* t_us,
+                            uint8_t stripHeaderLen,
+                            ShtpMsgInfo_t* info = 0);
+    virtual int DecodeAvailable(void);
+
+    virtual void WriteEncodedFrame(UCHAR* bytes, DWORD length);
+    virtual void PrefaultBuffers(void);
 
 	virtual BOOL WriteBytesToDevice(LPVOID lpBuffer,
 		DWORD nNumberOfBytesToWrite,
 		LPDWORD lpNumberOfBytesWritten);
 
-    int RpiUartRead(uint8_t* buf, uint32_t buffer_size);
+    int RpiUartRead(uint8_t* buf, uint32_t buffer_size, uint32_t timeout_us);
+    int BusyPollRead(uint8_t* buf, uint32_t buffer_size);
+    int AllocBuffers(void);
+    uint32_t NextReadSize(void);
+    void SampleRxQueue(size_t bytesRead, uint32_t readSize);
+    bool ReadIcount(uint32_t counts[5]);
+    void DeviceLost(int err);
+    int TryReconnect(void);
+    void UpdatePollEvents(void);
+    void WatchDevice(bool watch);
+    void ArmReconnectTimer(bool arm);
+    void ClosePollFds(void);
 	
 	int deviceDescriptor_;
+
+    bool useIoUring_;
+    UringTransport uring_;
+    uint8_t* rxBuffer_;
+    size_t rxBufferLen_;
+
+    uint32_t maxRead_;
+    uint32_t drainThreshold_;
+    uint32_t readEwma_;   // Bytes per read, smoothed
+    uint32_t lastWaiting_; // FIONREAD after the last read
+
+    uint32_t busyPollUs_;
+    BusyPollStats_t busyPollStats_;
+
+    LineStats_t lineStats_;
+    uint32_t icountBase_[5]; // Driver counts at open: overrun, frame, parity, brk, buf_overrun
+
+    bool autoReconnect_;
+    bool lost_;         // Device gone, reads poll for it to come back
+    bool reconnecting_; // TryReconnect() is inside open()
+    uint32_t reconnectPollUs_;
+    uint64_t lostAt_us_;
+    uint64_t lastAttempt_us_;
+    ReconnectStats_t reconnectStats_;
+    ReconnectCb_t* reconnectCb_;
+    void* reconnectCookie_;
+
+    int epollFd_;          // What pollFd() hands out
+    int eventFd_;          // Readable while messages wait in the HAL
+    int timerFd_;          // Ticks while the device is lost
+    bool queuedSignalled_; // eventFd_ is raised
+    int serviceReads_;     // Device reads left in this service() pass, -1 outside service()
+    std::vector<uint8_t> serviceBuf_;
 };
 
 #endif // FTDI_HAL_RPI_H
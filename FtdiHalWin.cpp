@@ -64,12 +64,20 @@ int FtdiHalWin::init(int deviceIdx, TimerSrv* timer) {
 int FtdiHalWin::open() {
     FT_STATUS status;
 
+    StartOpenTiming();
     status = FT_Open(deviceIdx_, &ftHandle_);
     if (status != FT_OK) {
         fprintf(stderr, "Unable to find an FTDI COM port\n");
         return -1;
     }
 
+    FT_DEVICE ftDevice;
+    DWORD deviceId;
+    char description[64];
+    if (FT_GetDeviceInfo(ftHandle_, &ftDevice, &deviceId, serial_, description, NULL) != FT_OK) {
+        serial_[0] = 0;
+    }
+
     LONG comPort = -1;
     status = FT_GetComPortNumber(ftHandle_, &comPort);
     fprintf(stderr, "FTDI device found on COM%d\n", comPort);
@@ -109,8 +117,17 @@ int FtdiHalWin::open() {
     commEvent = CreateEvent(NULL, false, false, "");
     FT_SetEventNotification(ftHandle_, FT_EVENT_RXCHAR, commEvent);
 
-    // Issue Soft reset which triggers SensorHub to send the advertise response
-    softreset();
+    framer_.resetStats();
+    ResetShtpTracking();
+    router_.resetStats();
+    MarkOpenPhase(&openTiming_.configure_us);
+
+    // Issue Soft reset which triggers SensorHub to send the advertise response, unless the hub
+    // is already running and can be picked up as it is
+    if (!TryWarmAttach()) {
+        softreset();
+    }
+    MarkOpenPhase(&openTiming_.reset_us);
 
     return 0;
 }
@@ -0,0 +1,469 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HAL_COROUTINE_H
+#define HAL_COROUTINE_H
+
+/** @file @brief C++20 coroutine front end for FtdiHalRpi (Linux).
+ *
+ * Opt in: the library itself builds as C++11 and doesn't use this header. Compiled as C++20 it
+ * provides awaitables for receiving and sending SHTP messages, and a scheduler that multiplexes
+ * any number of hubs on the calling thread through FtdiHalRpi::pollFd() and service(). A
+ * coroutine waiting for a message is resumed from inside service() as soon as the message is
+ * decoded, with no queue or thread handoff in between.
+ *
+ * @code
+ * HalTask configure(CoHal& hub) {
+ *     co_await hub.send(setFeature, sizeof(setFeature));
+ *     HalMessage_t resp = co_await hub.request(getFeature, sizeof(getFeature), 2, 0xFC, 100000);
+ *     for (;;) {
+ *         HalMessage_t m = co_await hub.nextMessage(3);
+ *         ...
+ *     }
+ * }
+ * @endcode
+ */
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "FtdiHalRpi.h"
+
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <errno.h>
+#include <exception>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <vector>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define HAL_CO_ANY -1           // Any channel or report ID in CoHal::nextMessage
+#define HAL_CO_BACKLOG_DEPTH 64 // Messages kept per hub while nobody waits for them
+#define HAL_CO_MAX_EVENTS 16
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+/** @brief A received message, or why none was. */
+typedef struct HalMessage_s {
+    int status;                // 0 received, -1 timed out, -2 the hub was detached,
+                               // -3 request() could not send its command
+    uint32_t t_us;             // Receive timestamp
+    std::vector<uint8_t> data; // As returned by read(): SHTP header first, then the payload
+} HalMessage_t;
+
+// =================================================================================================
+// CLASS DEFINITION - HalTask
+// =================================================================================================
+/** @brief Return type of a fire-and-forget coroutine.
+ *
+ * The coroutine starts running when called and frees itself when it returns. Exceptions end
+ * the program, the HAL doesn't use them.
+ */
+class HalTask {
+public:
+    struct promise_type {
+        HalTask get_return_object(void) {
+            return HalTask();
+        }
+        std::suspend_never initial_suspend(void) {
+            return std::suspend_never();
+        }
+        std::suspend_never final_suspend(void) noexcept {
+            return std::suspend_never();
+        }
+        void return_void(void) {
+        }
+        void unhandled_exception(void) {
+            std::terminate();
+        }
+    };
+};
+
+class HalScheduler;
+
+// =================================================================================================
+// CLASS DEFINITION - CoHal
+// =================================================================================================
+/** @brief One hub as seen by coroutines.
+ *
+ * Messages go to every coroutine waiting for one that matches when it is decoded. Messages no
+ * one is waiting for are kept, up to HAL_CO_BACKLOG_DEPTH, oldest dropped first, for the next
+ * coroutine that asks; so a workflow busy with something else between two awaits doesn't miss
+ * its response. Single threaded: use from the thread running the scheduler only.
+ */
+class CoHal {
+public:
+    /** @brief Awaitable for the next matching message, see nextMessage(). */
+    class MessageAwaiter {
+    public:
+        MessageAwaiter(CoHal* hub, int channel, int reportId, uint32_t timeout_us)
+            : hub_(hub), channel_(channel), reportId_(reportId), timeout_us_(timeout_us),
+              sendFailed_(false) {
+            msg_.status = -1;
+            msg_.t_us = 0;
+        }
+
+        bool await_ready(void) {
+            return sendFailed_ || hub_->TakeBacklog(this);
+        }
+        void await_suspend(std::coroutine_handle<> h) {
+            handle_ = h;
+            hasDeadline_ = (timeout_us_ != 0);
+            if (hasDeadline_) {
+                deadline_ = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us_);
+            }
+            hub_->waiters_.push_back(this);
+        }
+        HalMessage_t await_resume(void) {
+            return std::move(msg_);
+        }
+
+    private:
+        friend class CoHal;
+
+        bool Matches(const uint8_t* msg, unsigned len) const {
+            // read() layout: length LSB, length MSB, channel, seq, report ID
+            return (channel_ == HAL_CO_ANY || (len > 2 && msg[2] == channel_)) &&
+                   (reportId_ == HAL_CO_ANY || (len > 4 && msg[4] == reportId_));
+        }
+
+        CoHal* hub_;
+        int channel_;
+        int reportId_;
+        uint32_t timeout_us_;
+        bool sendFailed_; // request() couldn't send, complete at once with status -3
+        bool hasDeadline_;
+        std::chrono::steady_clock::time_point deadline_;
+        std::coroutine_handle<> handle_;
+        HalMessage_t msg_;
+    };
+
+    /** @brief Awaitable that sends a message, see send(). Completes without suspending. */
+    class SendAwaiter {
+    public:
+        SendAwaiter(FtdiHalRpi* hal, const uint8_t* msg, unsigned len)
+            : hal_(hal), msg_(msg), len_(len) {
+        }
+
+        bool await_ready(void) {
+            return true;
+        }
+        void await_suspend(std::coroutine_handle<>) {
+        }
+        int await_resume(void) {
+            return hal_->write(const_cast<uint8_t*>(msg_), len_);
+        }
+
+    private:
+        FtdiHalRpi* hal_;
+        const uint8_t* msg_;
+        unsigned len_;
+    };
+
+    CoHal(HalScheduler& scheduler, FtdiHalRpi& hal);
+    ~CoHal();
+
+    /** @brief Wait for a message.
+     * @param channel SHTP channel to match, HAL_CO_ANY for any
+     * @param reportId first payload byte to match, HAL_CO_ANY for any
+     * @param timeout_us give up after this long (status -1), 0 waits indefinitely
+     */
+    MessageAwaiter nextMessage(int channel = HAL_CO_ANY,
+                               int reportId = HAL_CO_ANY,
+                               uint32_t timeout_us = 0) {
+        return MessageAwaiter(this, channel, reportId, timeout_us);
+    }
+
+    /** @brief Send an SHTP message, as FtdiHal::write(). Writes are paced but don't wait for
+     * the hub, so there is nothing to suspend for; co_await yields write()'s return value. */
+    SendAwaiter send(const uint8_t* msg, unsigned len) {
+        return SendAwaiter(hal_, msg, len);
+    }
+
+    /** @brief Send a command and wait for its response. The command goes out immediately;
+     * nothing is dispatched before the co_await, so the response can't be missed.
+     * @return awaitable as nextMessage(channel, reportId, timeout_us); if the command couldn't
+     * be written it completes without suspending, with status -3
+     */
+    MessageAwaiter request(const uint8_t* cmd,
+                           unsigned len,
+                           int channel,
+                           int reportId,
+                           uint32_t timeout_us) {
+        MessageAwaiter awaiter(this, channel, reportId, timeout_us);
+        if (hal_->write(const_cast<uint8_t*>(cmd), len) < 0) {
+            awaiter.sendFailed_ = true;
+            awaiter.msg_.status = -3;
+        }
+        return awaiter;
+    }
+
+    FtdiHalRpi& hal(void) {
+        return *hal_;
+    }
+
+    /** @brief Messages dropped from the backlog because no one asked for them in time */
+    uint32_t dropped(void) const {
+        return dropped_;
+    }
+
+private:
+    friend class HalScheduler;
+
+    typedef struct Pending_s {
+        uint32_t t_us;
+        std::vector<uint8_t> data;
+    } Pending_t;
+
+    static void OnMessage(void* cookie, uint8_t* msg, unsigned len, uint32_t t_us) {
+        static_cast<CoHal*>(cookie)->Dispatch(msg, len, t_us);
+    }
+
+    // Hand a decoded message to every matching waiter, resuming them right here
+    void Dispatch(const uint8_t* msg, unsigned len, uint32_t t_us) {
+        std::vector<MessageAwaiter*> ready;
+        for (size_t i = 0; i < waiters_.size();) {
+            if (waiters_[i]->Matches(msg, len)) {
+                ready.push_back(waiters_[i]);
+                waiters_.erase(waiters_.begin() + i);
+            } else {
+                i++;
+            }
+        }
+
+        if (ready.empty()) {
+            if (backlog_.size() >= HAL_CO_BACKLOG_DEPTH) {
+                backlog_.pop_front();
+                dropped_++;
+            }
+            backlog_.push_back(Pending_t());
+            backlog_.back().t_us = t_us;
+            backlog_.back().data.assign(msg, msg + len);
+            return;
+        }
+
+        // Coroutines resumed here may await again; they wait for the next message, not this one
+        for (size_t i = 0; i < ready.size(); i++) {
+            ready[i]->msg_.status = 0;
+            ready[i]->msg_.t_us = t_us;
+            ready[i]->msg_.data.assign(msg, msg + len);
+        }
+        for (size_t i = 0; i < ready.size(); i++) {
+            ready[i]->handle_.resume();
+        }
+    }
+
+    bool TakeBacklog(MessageAwaiter* w) {
+        for (size_t i = 0; i < backlog_.size(); i++) {
+            const Pending_t& p = backlog_[i];
+            if (w->Matches(p.data.data(), (unsigned)p.data.size())) {
+                w->msg_.status = 0;
+                w->msg_.t_us = p.t_us;
+                w->msg_.data = std::move(backlog_[i].data);
+                backlog_.erase(backlog_.begin() + i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Resume waiters whose deadline passed (status -1), or all of them (status -2)
+    void Expire(std::chrono::steady_clock::time_point now, bool all) {
+        std::vector<MessageAwaiter*> expired;
+        for (size_t i = 0; i < waiters_.size();) {
+            if (all || (waiters_[i]->hasDeadline_ && waiters_[i]->deadline_ <= now)) {
+                expired.push_back(waiters_[i]);
+                waiters_.erase(waiters_.begin() + i);
+            } else {
+                i++;
+            }
+        }
+        for (size_t i = 0; i < expired.size(); i++) {
+            expired[i]->msg_.status = all ? -2 : -1;
+            expired[i]->handle_.resume();
+        }
+    }
+
+    bool NextDeadline(std::chrono::steady_clock::time_point* deadline) const {
+        bool found = false;
+        for (size_t i = 0; i < waiters_.size(); i++) {
+            if (waiters_[i]->hasDeadline_ && (!found || waiters_[i]->deadline_ < *deadline)) {
+                *deadline = waiters_[i]->deadline_;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    HalScheduler* scheduler_;
+    FtdiHalRpi* hal_;
+    std::vector<MessageAwaiter*> waiters_;
+    std::deque<Pending_t> backlog_;
+    uint32_t dropped_;
+};
+
+// =================================================================================================
+// CLASS DEFINITION - HalScheduler
+// =================================================================================================
+/** @brief Event loop for CoHal hubs on the calling thread.
+ *
+ * Waits on every hub's pollFd() at once and runs service() on the ones with work, which
+ * resumes the coroutines waiting for what was decoded. Run one scheduler per thread to spread
+ * hubs over a few threads; a hub belongs to one scheduler.
+ */
+class HalScheduler {
+public:
+    HalScheduler(void) : epollFd_(epoll_create1(EPOLL_CLOEXEC)), stop_(false) {
+        if (epollFd_ < 0) {
+            perror("HalScheduler: epoll_create1");
+        }
+    }
+    ~HalScheduler() {
+        if (epollFd_ >= 0) {
+            ::close(epollFd_);
+        }
+    }
+
+    /** @brief Wait for and dispatch what is ready, at most timeout_ms (-1 waits until
+     * something happens). Coroutines awaiting with a timeout are resumed when it expires.
+     * @return number of messages dispatched, -1 on error
+     */
+    int runOnce(int timeout_ms) {
+        if (epollFd_ < 0) {
+            return -1;
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point deadline;
+        bool haveDeadline = false;
+        for (size_t i = 0; i < hubs_.size(); i++) {
+            std::chrono::steady_clock::time_point d;
+            if (hubs_[i]->NextDeadline(&d) && (!haveDeadline || d < deadline)) {
+                deadline = d;
+                haveDeadline = true;
+            }
+        }
+        if (haveDeadline) {
+            long long wait_ms =
+                    (deadline <= now)
+                            ? 0
+                            : std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now)
+                                              .count() + 1;
+            if (timeout_ms < 0 || wait_ms < timeout_ms) {
+                timeout_ms = (int)wait_ms;
+            }
+        }
+
+        struct epoll_event events[HAL_CO_MAX_EVENTS];
+        int n = epoll_wait(epollFd_, events, HAL_CO_MAX_EVENTS, timeout_ms);
+        if (n < 0 && errno != EINTR) {
+            perror("HalScheduler: epoll_wait");
+            return -1;
+        }
+
+        int dispatched = 0;
+        for (int i = 0; i < n; i++) {
+            CoHal* hub = static_cast<CoHal*>(events[i].data.ptr);
+            int rc = hub->hal_->service(&CoHal::OnMessage, hub);
+            if (rc > 0) {
+                dispatched += rc;
+            }
+        }
+
+        now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < hubs_.size(); i++) {
+            hubs_[i]->Expire(now, false);
+        }
+        return dispatched;
+    }
+
+    /** @brief runOnce() until stop() is called, e.g. from a coroutine. */
+    void run(void) {
+        stop_ = false;
+        while (!stop_) {
+            if (runOnce(-1) < 0) {
+                break;
+            }
+        }
+    }
+
+    void stop(void) {
+        stop_ = true;
+    }
+
+private:
+    friend class CoHal;
+
+    int Attach(CoHal* hub) {
+        int fd = hub->hal_->pollFd();
+        if (fd < 0 || epollFd_ < 0) {
+            return -1;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = hub;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("HalScheduler: epoll_ctl");
+            return -1;
+        }
+        hubs_.push_back(hub);
+        return 0;
+    }
+
+    void Detach(CoHal* hub) {
+        for (size_t i = 0; i < hubs_.size(); i++) {
+            if (hubs_[i] == hub) {
+                epoll_ctl(epollFd_, EPOLL_CTL_DEL, hub->hal_->pollFd(), NULL);
+                hubs_.erase(hubs_.begin() + i);
+                break;
+            }
+        }
+    }
+
+    int epollFd_;
+    bool stop_;
+    std::vector<CoHal*> hubs_;
+};
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - CoHal
+// =================================================================================================
+inline CoHal::CoHal(HalScheduler& scheduler, FtdiHalRpi& hal)
+    : scheduler_(&scheduler), hal_(&hal), dropped_(0) {
+    if (scheduler_->Attach(this) < 0) {
+        fprintf(stderr, "CoHal: unable to attach hub to the scheduler\n");
+    }
+}
+
+// Coroutines still waiting on the hub are resumed with status -2 so they can wind down
+inline CoHal::~CoHal() {
+    scheduler_->Detach(this);
+    Expire(std::chrono::steady_clock::now(), true);
+}
+
+#endif // __cpp_impl_coroutine
+#endif // HAL_COROUTINE_H
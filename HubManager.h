@@ -0,0 +1,147 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HUB_MANAGER_H
+#define HUB_MANAGER_H
+
+/** @file @brief Discovery and bring-up of several sensor hubs on one host (Linux).
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "FtdiHalRpi.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define FTDI_VID 0x0403
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+class TimerSrv;
+
+// A USB serial adapter found in sysfs
+typedef struct HubInfo_s {
+    char devicePath[FTDI_HAL_DEVICE_PATH_LEN]; // e.g. /dev/ttyUSB3, may change across reboots
+    char serial[64];                           // USB serial number, empty if the device has none
+    char portPath[64];                         // USB topology, e.g. 1-1.2: fixed by the socket used
+    uint16_t vid;
+    uint16_t pid;
+} HubInfo_t;
+
+// =================================================================================================
+// CLASS DEFINITION - HubManager
+// =================================================================================================
+/** @brief Owns one FtdiHalRpi per hub and brings them up together.
+ *
+ * Hubs are found through sysfs rather than by ttyUSB number, so a hub can be addressed by its
+ * serial number or by the USB port it is plugged into, both of which survive a reboot. Each
+ * HAL can be configured through hal() between add() and openAll(); openAll() then opens and
+ * soft resets all of them at once, one thread per hub, so bring-up costs as long as the slowest
+ * hub instead of the sum of all of them.
+ */
+class HubManager {
+public:
+    explicit HubManager(TimerSrv* timer);
+    ~HubManager();
+
+    /** @brief List the USB serial adapters with the given IDs, sorted by USB port path.
+     * @param hubs receives the adapters found
+     * @param vid USB vendor ID to match, 0 for any
+     * @param pid USB product ID to match, 0 for any
+     * @return number of adapters found, -1 if sysfs couldn't be read
+     */
+    static int discover(std::vector<HubInfo_t>* hubs, uint16_t vid = FTDI_VID, uint16_t pid = 0);
+
+    /** @brief Describe the USB serial adapter behind one tty.
+     * @param devicePath e.g. /dev/ttyUSB0; symlinks such as udev names are followed, and
+     * hub->devicePath gets the tty node they lead to
+     * @param hub receives the adapter's description
+     * @return false if the tty isn't a USB device
+     */
+    static bool describe(const char* devicePath, HubInfo_t* hub);
+
+    /** @brief Create and init the HAL for a hub.
+     * @return the hub's index, -1 on error
+     */
+    int add(const HubInfo_t& hub);
+
+    /** @brief add() every adapter discover() finds.
+     * @return number of hubs added, -1 if sysfs couldn't be read
+     */
+    int addAll(uint16_t vid = FTDI_VID, uint16_t pid = 0);
+
+    size_t count(void) const {
+        return hubs_.size();
+    }
+
+    FtdiHalRpi* hal(size_t index) {
+        return hubs_[index].hal;
+    }
+
+    const HubInfo_t& info(size_t index) const {
+        return hubs_[index].info;
+    }
+
+    /** @brief Index of the hub with this serial number or USB port path, -1 if none */
+    int find(const char* serialOrPort) const;
+
+    /** @brief Open and soft reset every hub in parallel.
+     *
+     * Each open runs on its own thread. A HAL with an RtProfile set gets it applied to that
+     * thread first (per device, see RtProfile::forDevice), so TX pacing and calibration run
+     * with the intended scheduling.
+     * @return 0 if every hub opened, -1 if any failed (see openStatus())
+     */
+    int openAll(void);
+
+    /** @brief Result of the hub's last open, 0 on success */
+    int openStatus(size_t index) const {
+        return hubs_[index].status;
+    }
+
+    /** @brief How long the hub's last open took */
+    uint32_t openTime_us(size_t index) const {
+        return hubs_[index].openTime_us;
+    }
+
+    void closeAll(void);
+
+private:
+    typedef struct Hub_s {
+        HubInfo_t info;
+        FtdiHalRpi* hal;
+        bool open;
+        int status;
+        uint32_t openTime_us;
+    } Hub_t;
+
+    TimerSrv* timer_;
+    std::vector<Hub_t> hubs_;
+
+    // Not copyable, owns the HALs
+    HubManager(const HubManager&);
+    HubManager& operator=(const HubManager&);
+};
+
+#endif // HUB_MANAGER_H
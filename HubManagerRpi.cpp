@@ -0,0 +1,260 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "HubManager.h"
+#include "TimerService.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define SYS_CLASS_TTY "/sys/class/tty"
+#define USB_LEVELS 4 // tty -> usb-serial port -> interface -> USB device
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+// Read the first line of a sysfs attribute
+static bool read_attr(const char* dir, const char* attr, char* buf, size_t len) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = (fgets(buf, len, f) != NULL);
+    fclose(f);
+    if (ok) {
+        buf[strcspn(buf, "\r\n")] = 0;
+    }
+    return ok;
+}
+
+// Fill in hub from the USB device above /sys/class/tty/<ttyName>
+static bool describe_tty(const char* ttyName, HubInfo_t* hub) {
+    char sysPath[PATH_MAX];
+    char path[PATH_MAX];
+    char attr[16];
+
+    snprintf(sysPath, sizeof(sysPath), SYS_CLASS_TTY "/%s/device", ttyName);
+    if (realpath(sysPath, path) == NULL) {
+        return false; // Not backed by a device (virtual console, pty, ...)
+    }
+
+    // Walk up to the USB device directory, the first one with an idVendor
+    for (int level = 0; level < USB_LEVELS; level++) {
+        if (read_attr(path, "idVendor", attr, sizeof(attr))) {
+            memset(hub, 0, sizeof(*hub));
+            hub->vid = (uint16_t)strtoul(attr, NULL, 16);
+            if (read_attr(path, "idProduct", attr, sizeof(attr))) {
+                hub->pid = (uint16_t)strtoul(attr, NULL, 16);
+            }
+            if (!read_attr(path, "serial", hub->serial, sizeof(hub->serial))) {
+                hub->serial[0] = 0;
+            }
+            const char* port = strrchr(path, '/');
+            snprintf(hub->portPath, sizeof(hub->portPath), "%s", port + 1);
+            snprintf(hub->devicePath, sizeof(hub->devicePath), "/dev/%s", ttyName);
+            return true;
+        }
+        char* slash = strrchr(path, '/');
+        if (slash == NULL || slash == path) {
+            break;
+        }
+        *slash = 0;
+    }
+    return false;
+}
+
+// USB port paths sort like version numbers: 1-1.2 before 1-1.10
+static bool port_less(const HubInfo_t& a, const HubInfo_t& b) {
+    return strverscmp(a.portPath, b.portPath) < 0;
+}
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - HubManager
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// HubManager::HubManager
+// -------------------------------------------------------------------------------------------------
+HubManager::HubManager(TimerSrv* timer) : timer_(timer) {
+}
+
+// -------------------------------------------------------------------------------------------------
+// HubManager::~HubManager
+// -------------------------------------------------------------------------------------------------
+HubManager::~HubManager() {
+    closeAll();
+    for (size_t i = 0; i < hubs_.size(); i++) {
+        delete hubs_[i].hal;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// HubManager::discover
+// -------------------------------------------------------------------------------------------------
+int HubManager::discover(std::vector<HubInfo_t>* hubs, uint16_t vid, uint16_t pid) {
+    DIR* dir = opendir(SYS_CLASS_TTY);
+    if (dir == NULL) {
+        fprintf(stderr, "Unable to read " SYS_CLASS_TTY "\n");
+        return -1;
+    }
+
+    hubs->clear();
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        HubInfo_t hub;
+        if (entry->d_name[0] == '.' || !describe_tty(entry->d_name, &hub)) {
+            continue;
+        }
+        if ((vid == 0 || hub.vid == vid) && (pid == 0 || hub.pid == pid)) {
+            hubs->push_back(hub);
+        }
+    }
+    closedir(dir);
+
+    std::sort(hubs->begin(), hubs->end(), port_less);
+    return (int)hubs->size();
+}
+
+// -------------------------------------------------------------------------------------------------
+// HubManager::describe
+// -------------------------------------------------------------------------------------------------
+bool HubManager::describe(const char* devicePath, HubInfo_t* hub) {
+    char path[PATH_MAX];
+
+    if (realpath(devicePath, path) == NULL) {
+        return false;
+    }
+    const char* ttyName = strrchr(path, '/');
+    return describe_tty((ttyName != NULL) ? ttyName + 1 : path, hub);
+}
+
+// -------------------------------------------------------------------------------------------------
+// HubManager::add
+// -------------------------------------------------------------------------------------------------
+int HubManager::add(const HubInfo_t& info) {
+    Hub_t hub;
+    hub.info = info;
+    hub.hal = new FtdiHalRpi();
+    hub.open = false;
+    hub.status = -1;
+    hub.openTime_us = 0;
+
+    // The hub's index is its device index, so perDeviceCpu spreads the hubs over the CPUs
+    if (hub.hal->init(info.devicePath, (int)hubs_.size(), timer_) != 0) {
+        delete hub.hal;
+        return -1;
+    }
+
+    hubs_.push_back(hub);
+    return (int)hubs_.size() - 1;
+}
+
+// -------------------------------------------------------------------------------------------------
+// HubManager::addAll
+// -------------------------------------------------------------------------------------------------
+int HubManager::addAll(uint16_t vid, uint16_t pid) {
+    std::vector<HubInfo_t> found;
+    if (discover(&found, vid, pid) < 0) {
+        return -1;
+    }
+
+    int added = 0;
+    for (size_t i = 0; i < found.size(); i++) {
+        if (add(found[i]) >= 0) {
+            added++;
+        }
+    }
+    return added;
+}
+
+// -------------------------------------------------------------------------------------------------
+// HubManager::find
+// -------------------------------------------------------------------------------------------------
+int HubManager::find(const char* serialOrPort) const {
+    for (size_t i = 0; i < hubs_.size(); i++) {
+        const HubInfo_t& info = hubs_[i].info;
+        if ((info.serial[0] != 0 && strcmp(info.serial, serialOrPort) == 0) ||
+            strcmp(info.portPath, serialOrPort) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// -------------------------------------------------------------------------------------------------
+// HubManager::openAll
+// -------------------------------------------------------------------------------------------------
+int HubManager::openAll(void) {
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < hubs_.size(); i++) {
+        if (hubs_[i].open) {
+            continue;
+        }
+        Hub_t* hub = &hubs_[i];
+        TimerSrv* timer = timer_;
+        threads.push_back(std::thread([hub, timer]() {
+            const RtProfile& profile = hub->hal->rtProfile();
+            if (profile.policy != RtProfile::POLICY_DEFAULT || profile.cpuMask != 0) {
+                profile.forDevice(hub->hal->deviceIdx()).apply();
+            }
+            uint64_t start = timer->getTimestamp_us();
+            hub->status = hub->hal->open();
+            hub->openTime_us = (uint32_t)(timer->getTimestamp_us() - start);
+            hub->open = (hub->status == 0);
+        }));
+    }
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < hubs_.size(); i++) {
+        if (!hubs_[i].open) {
+            fprintf(stderr, "Hub %s (%s) failed to open\n", hubs_[i].info.devicePath,
+                    hubs_[i].info.portPath);
+            status = -1;
+        }
+    }
+    return status;
+}
+
+// -------------------------------------------------------------------------------------------------
+// HubManager::closeAll
+// -------------------------------------------------------------------------------------------------
+void HubManager::closeAll(void) {
+    for (size_t i = 0; i < hubs_.size(); i++) {
+        if (hubs_[i].open) {
+            hubs_[i].hal->close();
+            hubs_[i].open = false;
+        }
+    }
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "LatestValueCache.h"
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define CACHE_LINE 64
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - LatestValueCache
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// LatestValueCache::LatestValueCache
+// -------------------------------------------------------------------------------------------------
+LatestValueCache::LatestValueCache(void) {
+    static_assert(sizeof(Slot_t) == CACHE_LINE, "a slot must fill exactly one cache line");
+
+    // Aligned by hand, over-aligned new is C++17
+    slots_ = 0;
+    mem_ = malloc(LATEST_VALUE_SENSORS * sizeof(Slot_t) + CACHE_LINE);
+    if (mem_ == 0) {
+        fprintf(stderr, "LatestValueCache: out of memory\n");
+        return;
+    }
+    uintptr_t p = ((uintptr_t)mem_ + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1);
+    slots_ = (Slot_t*)p;
+    for (unsigned i = 0; i < LATEST_VALUE_SENSORS; i++) {
+        new (&slots_[i]) Slot_t();
+    }
+    clear();
+}
+
+// -------------------------------------------------------------------------------------------------
+// LatestValueCache::~LatestValueCache
+// -------------------------------------------------------------------------------------------------
+LatestValueCache::~LatestValueCache(void) {
+    if (slots_ == 0) {
+        return;
+    }
+    for (unsigned i = 0; i < LATEST_VALUE_SENSORS; i++) {
+        slots_[i].~Slot_t();
+    }
+    free(mem_);
+}
+
+// -------------------------------------------------------------------------------------------------
+// LatestValueCache::onReport
+// -------------------------------------------------------------------------------------------------
+void LatestValueCache::onReport(const uint8_t* report, size_t len, uint32_t t_us) {
+    if (slots_ == 0 || len == 0) {
+        return;
+    }
+    if (len > LATEST_VALUE_MAX_LEN) {
+        len = LATEST_VALUE_MAX_LEN;
+    }
+
+    Slot_t& s = slots_[report[0]];
+    uint32_t seq = s.seq.load(std::memory_order_relaxed);
+
+    // Odd: readers back off. The fence keeps the payload stores below from moving above it.
+    s.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint32_t words[LATEST_VALUE_MAX_LEN / 4];
+    memcpy(words, report, len);
+    for (size_t i = 0; i < (len + 3) / 4; i++) {
+        s.words[i].store(words[i], std::memory_order_relaxed);
+    }
+    s.t_us.store(t_us, std::memory_order_relaxed);
+    s.len.store((uint32_t)len, std::memory_order_relaxed);
+
+    s.seq.store(seq + 2, std::memory_order_release);
+}
+
+// -------------------------------------------------------------------------------------------------
+// LatestValueCache::get
+// -------------------------------------------------------------------------------------------------
+size_t LatestValueCache::get(uint8_t sensorId, uint8_t* dest, size_t len, uint32_t* t_us) const {
+    if (slots_ == 0) {
+        return 0;
+    }
+
+    const Slot_t& s = slots_[sensorId];
+    uint32_t words[LATEST_VALUE_MAX_LEN / 4];
+    uint32_t seq;
+    uint32_t stamp = 0;
+    size_t n = 0;
+
+    do {
+        seq = s.seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            continue; // Being written
+        }
+        n = s.len.load(std::memory_order_relaxed);
+        stamp = s.t_us.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < (n + 3) / 4; i++) {
+            words[i] = s.words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || s.seq.load(std::memory_order_relaxed) != seq);
+
+    if (n > len) {
+        n = len;
+    }
+    memcpy(dest, words, n);
+    if (t_us != 0) {
+        *t_us = stamp;
+    }
+    return n;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LatestValueCache::updates
+// -------------------------------------------------------------------------------------------------
+uint32_t LatestValueCache::updates(uint8_t sensorId) const {
+    if (slots_ == 0) {
+        return 0;
+    }
+    return slots_[sensorId].seq.load(std::memory_order_acquire) / 2;
+}
+
+// -------------------------------------------------------------------------------------------------
+// LatestValueCache::clear
+// -------------------------------------------------------------------------------------------------
+void LatestValueCache::clear(void) {
+    if (slots_ == 0) {
+        return;
+    }
+    for (unsigned i = 0; i < LATEST_VALUE_SENSORS; i++) {
+        slots_[i].seq.store(0, std::memory_order_relaxed);
+        slots_[i].t_us.store(0, std::memory_order_relaxed);
+        slots_[i].len.store(0, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+}
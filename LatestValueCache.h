@@ -0,0 +1,92 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LATEST_VALUE_CACHE_H
+#define LATEST_VALUE_CACHE_H
+
+/** @file @brief Most recent report of each sensor, readable from any thread.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "ReportSink.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define LATEST_VALUE_MAX_LEN 52 // Longest report kept; the longest known sensor report is 16
+#define LATEST_VALUE_SENSORS 256
+
+// =================================================================================================
+// CLASS DEFINITION - LatestValueCache
+// =================================================================================================
+/** @brief One seqlock slot per sensor holding its last report and receive timestamp.
+ *
+ * Fed by the HAL's reading thread through ReportSink; read by any number of threads that only
+ * care about the current value (UI, health checks, slow control loops) without draining or
+ * slowing down the stream consumer. A read copies one 64-byte, cache-line-aligned slot and
+ * checks its sequence number; it only retries if that very slot was being rewritten during the
+ * copy, and the writer never waits for readers.
+ *
+ * Single writer: feed a cache from one HAL only.
+ */
+class LatestValueCache : public ReportSink {
+public:
+    LatestValueCache(void);
+    virtual ~LatestValueCache(void);
+
+    virtual void onReport(const uint8_t* report, size_t len, uint32_t t_us);
+
+    /** @brief Copy the latest report of a sensor.
+     * @param sensorId sensor (report ID)
+     * @param dest receives the report, starting at the report ID
+     * @param len size of dest, longer reports are truncated
+     * @param t_us receives the receive timestamp, may be NULL
+     * @return number of bytes placed in dest, 0 if the sensor hasn't reported
+     */
+    size_t get(uint8_t sensorId, uint8_t* dest, size_t len, uint32_t* t_us = 0) const;
+
+    /** @brief Number of reports received for a sensor. Compare against an earlier value to
+     * tell whether get() would return something new. */
+    uint32_t updates(uint8_t sensorId) const;
+
+    /** @brief Forget every report. Not safe while the HAL is feeding the cache. */
+    void clear(void);
+
+private:
+    // Plain words behind relaxed atomics: the seqlock orders them, the atomics keep a torn
+    // read well defined (it is detected and retried)
+    typedef struct Slot_s {
+        std::atomic<uint32_t> seq; // Odd while the slot is being written
+        std::atomic<uint32_t> t_us;
+        std::atomic<uint32_t> len;
+        std::atomic<uint32_t> words[LATEST_VALUE_MAX_LEN / 4];
+    } Slot_t;
+
+    LatestValueCache(const LatestValueCache&);
+    LatestValueCache& operator=(const LatestValueCache&);
+
+    void* mem_;     // Allocation slots_ is carved from, over-allocated to align it
+    Slot_t* slots_; // LATEST_VALUE_SENSORS entries, each on its own cache line
+};
+
+#endif // LATEST_VALUE_CACHE_H
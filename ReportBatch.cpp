@@ -0,0 +1,196 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "ReportBatch.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define REPORT_BATCH_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define REPORT_BATCH_NEON 1
+#endif
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define LANES 4
+#define SCALE_Q(n) (1.0f / (1 << (n))) // As sh2_SensorValue.c
+#define SENSOR_DATA_OFFSET 4           // Report ID, sequence, status, delay
+#define GIRV_DATA_OFFSET 1             // Report ID only, see ReportSink
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+// Fields of one sensor: consecutive little endian int16s from offset, each with its Q point
+typedef struct Layout_s {
+    uint8_t sensorId;
+    uint8_t offset;
+    uint8_t columns;
+    uint8_t q[REPORT_BATCH_MAX_COLUMNS];
+} Layout_t;
+
+// =================================================================================================
+// LOCAL VARIABLES
+// =================================================================================================
+static const Layout_t layouts[] = {
+    {0x01, SENSOR_DATA_OFFSET, 3, {8, 8, 8}},                  // Accelerometer
+    {0x02, SENSOR_DATA_OFFSET, 3, {9, 9, 9}},                  // Gyroscope calibrated
+    {0x03, SENSOR_DATA_OFFSET, 3, {4, 4, 4}},                  // Magnetic field calibrated
+    {0x04, SENSOR_DATA_OFFSET, 3, {8, 8, 8}},                  // Linear acceleration
+    {0x05, SENSOR_DATA_OFFSET, 5, {14, 14, 14, 14, 12}},       // Rotation vector
+    {0x06, SENSOR_DATA_OFFSET, 3, {8, 8, 8}},                  // Gravity
+    {0x07, SENSOR_DATA_OFFSET, 6, {9, 9, 9, 9, 9, 9}},         // Gyroscope uncalibrated
+    {0x08, SENSOR_DATA_OFFSET, 4, {14, 14, 14, 14}},           // Game rotation vector
+    {0x09, SENSOR_DATA_OFFSET, 5, {14, 14, 14, 14, 12}},       // Geomagnetic rotation vector
+    {0x0F, SENSOR_DATA_OFFSET, 6, {4, 4, 4, 4, 4, 4}},         // Magnetic field uncalibrated
+    {0x28, SENSOR_DATA_OFFSET, 5, {14, 14, 14, 14, 12}},       // AR/VR stabilized RV
+    {0x29, SENSOR_DATA_OFFSET, 4, {14, 14, 14, 14}},           // AR/VR stabilized game RV
+    {0x2A, GIRV_DATA_OFFSET, 7, {14, 14, 14, 14, 10, 10, 10}}, // Gyro integrated RV
+};
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// find_layout
+// -------------------------------------------------------------------------------------------------
+static const Layout_t* find_layout(uint8_t sensorId) {
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        if (layouts[i].sensorId == sensorId) {
+            return &layouts[i];
+        }
+    }
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// read16
+// -------------------------------------------------------------------------------------------------
+static inline int32_t read16(const uint8_t* p) {
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+// -------------------------------------------------------------------------------------------------
+// scale4
+// -------------------------------------------------------------------------------------------------
+// int16 -> float is exact and the scale is a power of two, so every path rounds the same way
+// (it never has to) and matches sh2's read16(...) * SCALE_Q(n).
+static inline void scale4(const int32_t in[LANES], float scale, float out[LANES]) {
+#if defined(REPORT_BATCH_SSE2)
+    __m128 v = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)in));
+    _mm_storeu_ps(out, _mm_mul_ps(v, _mm_set1_ps(scale)));
+#elif defined(REPORT_BATCH_NEON)
+    float32x4_t v = vcvtq_f32_s32(vld1q_s32(in));
+    vst1q_f32(out, vmulq_n_f32(v, scale));
+#else
+    for (int i = 0; i < LANES; i++) {
+        out[i] = in[i] * scale;
+    }
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------
+// decode_column
+// -------------------------------------------------------------------------------------------------
+// One field of every report. The fields are strided, so they are gathered LANES at a time
+// into a contiguous block and converted from there.
+template <typename T>
+static void decode_column(const uint8_t* field, size_t stride, size_t count, float scale, T* out) {
+    int32_t raw[LANES];
+    float scaled[LANES];
+    size_t i = 0;
+
+    for (; i + LANES <= count; i += LANES) {
+        for (int l = 0; l < LANES; l++) {
+            raw[l] = read16(field + (i + l) * stride);
+        }
+        scale4(raw, scale, scaled);
+        for (int l = 0; l < LANES; l++) {
+            out[i + l] = scaled[l];
+        }
+    }
+    for (; i < count; i++) {
+        float v = read16(field + i * stride) * scale;
+        out[i] = v;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// decode_all
+// -------------------------------------------------------------------------------------------------
+template <typename T>
+static int decode_all(uint8_t sensorId,
+                      const uint8_t* reports,
+                      size_t stride,
+                      size_t count,
+                      T* const* out) {
+    const Layout_t* layout = find_layout(sensorId);
+    if (layout == 0) {
+        return -1;
+    }
+
+    for (unsigned c = 0; c < layout->columns; c++) {
+        decode_column(reports + layout->offset + 2 * c, stride, count, SCALE_Q(layout->q[c]),
+                      out[c]);
+    }
+    return (int)count;
+}
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - ReportBatch
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// ReportBatch::columns
+// -------------------------------------------------------------------------------------------------
+unsigned ReportBatch::columns(uint8_t sensorId) {
+    const Layout_t* layout = find_layout(sensorId);
+    return (layout == 0) ? 0 : layout->columns;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ReportBatch::reportLen
+// -------------------------------------------------------------------------------------------------
+size_t ReportBatch::reportLen(uint8_t sensorId) {
+    const Layout_t* layout = find_layout(sensorId);
+    return (layout == 0) ? 0 : layout->offset + 2 * layout->columns;
+}
+
+// -------------------------------------------------------------------------------------------------
+// ReportBatch::decode
+// -------------------------------------------------------------------------------------------------
+int ReportBatch::decode(uint8_t sensorId,
+                        const uint8_t* reports,
+                        size_t stride,
+                        size_t count,
+                        float* const* out) {
+    return decode_all(sensorId, reports, stride, count, out);
+}
+
+// -------------------------------------------------------------------------------------------------
+// ReportBatch::decode
+// -------------------------------------------------------------------------------------------------
+int ReportBatch::decode(uint8_t sensorId,
+                        const uint8_t* reports,
+                        size_t stride,
+                        size_t count,
+                        double* const* out) {
+    return decode_all(sensorId, reports, stride, count, out);
+}
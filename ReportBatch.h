@@ -0,0 +1,91 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REPORT_BATCH_H
+#define REPORT_BATCH_H
+
+/** @file @brief Batch conversion of sensor reports to engineering units.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include <stddef.h>
+#include <stdint.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define REPORT_BATCH_MAX_COLUMNS 7
+
+// =================================================================================================
+// CLASS DEFINITION - ReportBatch
+// =================================================================================================
+/** @brief Decodes many reports of one sensor at once into one array per field.
+ *
+ * Produces the same values as sh2_decodeSensorEvent() for the fixed point fields of the
+ * sensors listed below, bit for bit: each field is a signed 16-bit integer scaled by a power of
+ * two, which is exact in float (and in double), so the SIMD path (SSE2 or NEON where the target
+ * has it) and the scalar fallback give identical results. Header fields (sequence, status,
+ * delay) and timestamps are left to the caller.
+ *
+ * Reports are taken as ReportSink delivers them, starting at the report ID; gyro integrated
+ * rotation vector reports therefore carry the 0x2A ID in front of the payload sh2 decodes.
+ *
+ * Columns per sensor, in order:
+ * - 0x01 accelerometer, 0x04 linear acceleration, 0x06 gravity: x, y, z (m/s^2, Q8)
+ * - 0x02 gyroscope calibrated: x, y, z (rad/s, Q9)
+ * - 0x07 gyroscope uncalibrated: x, y, z, bias x, bias y, bias z (rad/s, Q9)
+ * - 0x03 magnetic field calibrated: x, y, z (uTesla, Q4)
+ * - 0x0F magnetic field uncalibrated: x, y, z, bias x, bias y, bias z (uTesla, Q4)
+ * - 0x05 rotation vector, 0x09 geomagnetic RV, 0x28 AR/VR RV: i, j, k, real (Q14), accuracy
+ *   (radians, Q12)
+ * - 0x08 game rotation vector, 0x29 AR/VR game RV: i, j, k, real (Q14)
+ * - 0x2A gyro integrated RV: i, j, k, real (Q14), angular velocity x, y, z (rad/s, Q10)
+ */
+class ReportBatch {
+public:
+    /** @brief Number of output columns for a sensor, 0 if it isn't supported. */
+    static unsigned columns(uint8_t sensorId);
+
+    /** @brief Bytes of each report decode() reads, from the report ID on; 0 if the sensor isn't
+     * supported. Shorter reports must not be passed. */
+    static size_t reportLen(uint8_t sensorId);
+
+    /** @brief Convert count reports of one sensor.
+     * @param sensorId sensor (report ID) all the reports are from
+     * @param reports first report, starting at its report ID
+     * @param stride bytes from one report to the next, each report at least reportLen() long
+     * @param count number of reports
+     * @param out columns(sensorId) arrays of at least count values each
+     * @return count, or -1 if the sensor isn't supported
+     */
+    static int decode(uint8_t sensorId,
+                      const uint8_t* reports,
+                      size_t stride,
+                      size_t count,
+                      float* const* out);
+
+    /** @brief As above with double output, the float results widened. */
+    static int decode(uint8_t sensorId,
+                      const uint8_t* reports,
+                      size_t stride,
+                      size_t count,
+                      double* const* out);
+};
+
+#endif // REPORT_BATCH_H
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REPORT_SINK_H
+#define REPORT_SINK_H
+
+/** @file @brief Interface for consumers fed sensor reports straight from the HAL receive path.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include <stddef.h>
+#include <stdint.h>
+
+// =================================================================================================
+// CLASS DEFINITION - ReportSink
+// =================================================================================================
+/** @brief Receives each sensor report as the HAL decodes it, see FtdiHal::addReportSink().
+ *
+ * Reports are split out of the messages on the sensor report channels; timestamp records are
+ * not passed on. Called on the thread reading the HAL, before the message is queued for read(),
+ * so implementations should copy what they need and return quickly.
+ */
+class ReportSink {
+public:
+    virtual ~ReportSink(void) {
+    }
+
+    /** @brief A sensor report was received.
+     * @param report the report, starting at its report ID (which is the sensor ID). Only valid
+     * during the call.
+     * @param len report length
+     * @param t_us host receive timestamp of the message carrying the report
+     */
+    virtual void onReport(const uint8_t* report, size_t len, uint32_t t_us) = 0;
+};
+
+#endif // REPORT_SINK_H
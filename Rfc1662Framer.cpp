@@ -20,9 +20,127 @@
 // =================================================================================================
 #include "Rfc1662Framer.h"
 
+#include <string.h>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 // =================================================================================================
 // DEFINES AND MACROS
 // =================================================================================================
+#define FCS16_POLY 0x8408u     // x^16 + x^12 + x^5 + 1, bit reversed
+#define FCS16_INIT 0xFFFFu
+#define FCS16_GOOD 0xF0B8u     // Residue over a frame and its FCS
+#define FCS32_POLY 0xEDB88320u // IEEE 802.3, bit reversed
+#define FCS32_INIT 0xFFFFFFFFu
+#define FCS32_GOOD 0xDEBB20E3u
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+// Slicing-by-8 tables: t[k][b] is the CRC update for byte b followed by k zero bytes
+typedef struct CrcTables_s {
+    uint32_t t[8][256];
+} CrcTables_t;
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static void crc_tables_build(CrcTables_t* tables, uint32_t poly) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+        }
+        tables->t[0][b] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t prev = tables->t[k - 1][b];
+            tables->t[k][b] = (prev >> 8) ^ tables->t[0][prev & 0xFF];
+        }
+    }
+}
+
+static const CrcTables_t* fcs16_tables(void) {
+    static CrcTables_t tables;
+    static bool built = (crc_tables_build(&tables, FCS16_POLY), true);
+    (void)built;
+    return &tables;
+}
+
+#if !defined(__ARM_FEATURE_CRC32)
+static const CrcTables_t* fcs32_tables(void) {
+    static CrcTables_t tables;
+    static bool built = (crc_tables_build(&tables, FCS32_POLY), true);
+    (void)built;
+    return &tables;
+}
+#endif
+
+// Reflected CRC update of up to 32 bits, eight bytes per step. The register only overlaps the
+// first bytes of each step, so the same code serves FCS-16 and FCS-32.
+static uint32_t crc_update(const CrcTables_t* tables, uint32_t crc, const uint8_t* p, size_t len) {
+    const uint32_t(*t)[256] = tables->t;
+
+    while (len >= 8) {
+        uint32_t lo = (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)) ^ crc;
+        uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+        ++p;
+        --len;
+    }
+    return crc;
+}
+
+static uint32_t fcs16_update(uint32_t crc, const uint8_t* p, size_t len) {
+    return crc_update(fcs16_tables(), crc, p, len);
+}
+
+static uint32_t fcs32_update(uint32_t crc, const uint8_t* p, size_t len) {
+#if defined(__ARM_FEATURE_CRC32)
+    // ARMv8 CRC32 instructions use the same polynomial
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32d(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = __crc32b(crc, *p);
+        ++p;
+        --len;
+    }
+    return crc;
+#else
+    return crc_update(fcs32_tables(), crc, p, len);
+#endif
+}
+
+// Byte stuff len bytes from src into dest, returns the number of bytes written
+static size_t stuff(uint8_t* dest, const uint8_t* src, size_t len) {
+    uint8_t* start = dest;
+    for (size_t i = 0; i < len; ++i) {
+        if (*src == Rfc1662Framer::FLAG || *src == Rfc1662Framer::ESC) {
+            *dest = Rfc1662Framer::ESC;
+            ++dest;
+            *dest = *src ^ Rfc1662Framer::XOR;
+        } else {
+            *dest = *src;
+        }
+        ++dest;
+        ++src;
+    }
+    return dest - start;
+}
 
 // =================================================================================================
 // CLASS VARIABLES
@@ -48,14 +166,24 @@ const unsigned int Rfc1662Framer::NUM_LEN_BYTES = 2;
 // -------------------------------------------------------------------------------------------------
 // Rfc1662Framer::Rfc1662Framer
 // -------------------------------------------------------------------------------------------------
-Rfc1662Framer::Rfc1662Framer(void) : state_(HUNT_), dest_(0), destLen_(0) {
+Rfc1662Framer::Rfc1662Framer(void)
+    : state_(HUNT_)
+    , dest_(0)
+    , destLen_(0)
+    , inPlace_(false)
+    , rawStart_(0)
+    , spans_(0)
+    , maxSpans_(0)
+    , fcs_(FCS_NONE)
+    , fcsLen_(0)
+    , encodeCrc_(0) {
+    resetStats();
 }
 
 // -------------------------------------------------------------------------------------------------
 // Rfc1662Framer::encode
 // -------------------------------------------------------------------------------------------------
 int Rfc1662Framer::encode(uint8_t* dest, const uint8_t* src, size_t len, BlockEncode_e be) {
-    size_t i;
     uint8_t* start;
 
     start = dest;
@@ -68,23 +196,27 @@ int Rfc1662Framer::encode(uint8_t* dest, const uint8_t* src, size_t len, BlockEn
     if (be == COMPLETE || be == FIRST) {
         *dest = FLAG;
         ++dest;
+        encodeCrc_ = (fcs_ == FCS_32) ? FCS32_INIT : FCS16_INIT;
     }
 
     // Encode buffer
-    for (i = 0; i < len; ++i) {
-        if (*src == FLAG || *src == ESC) {
-            *dest = ESC;
-            ++dest;
-            *dest = *src ^ XOR;
-        } else {
-            *dest = *src;
-        }
-        ++dest;
-        ++src;
+    dest += stuff(dest, src, len);
+
+    if (fcs_ == FCS_16) {
+        encodeCrc_ = fcs16_update(encodeCrc_, src, len);
+    } else if (fcs_ == FCS_32) {
+        encodeCrc_ = fcs32_update(encodeCrc_, src, len);
     }
 
     // Handle closing flag
     if (be == COMPLETE || be == LAST) {
+        if (fcs_ != FCS_NONE) {
+            // FCS goes out complemented, least significant byte first
+            uint32_t fcs = ~encodeCrc_;
+            uint8_t fcsBytes[4] = {(uint8_t)fcs, (uint8_t)(fcs >> 8), (uint8_t)(fcs >> 16),
+                                   (uint8_t)(fcs >> 24)};
+            dest += stuff(dest, fcsBytes, fcsLen_);
+        }
         *dest = FLAG;
         ++dest;
     }
@@ -92,6 +224,14 @@ int Rfc1662Framer::encode(uint8_t* dest, const uint8_t* src, size_t len, BlockEn
     return dest - start;
 }
 
+// -------------------------------------------------------------------------------------------------
+// Rfc1662Framer::setFcs
+// -------------------------------------------------------------------------------------------------
+void Rfc1662Framer::setFcs(Fcs_e fcs) {
+    fcs_ = fcs;
+    fcsLen_ = (fcs == FCS_32) ? 4 : (fcs == FCS_16) ? 2 : 0;
+}
+
 // -------------------------------------------------------------------------------------------------
 // Rfc1662Framer::decodeInit
 // -------------------------------------------------------------------------------------------------
@@ -99,6 +239,28 @@ void Rfc1662Framer::decodeInit(uint8_t* dest, size_t len) {
     dest_ = dest;
     destLen_ = len;
     state_ = HUNT_;
+    inPlace_ = false;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Rfc1662Framer::decodeSpans
+// -------------------------------------------------------------------------------------------------
+void Rfc1662Framer::decodeSpans(Rfc1662Span_t* spans, size_t maxSpans) {
+    spans_ = spans;
+    maxSpans_ = (spans != 0) ? maxSpans : 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Rfc1662Framer::decodeInitInPlace
+// -------------------------------------------------------------------------------------------------
+void Rfc1662Framer::decodeInitInPlace(uint8_t* buf, size_t len) {
+    dest_ = buf;
+    destLen_ = len;
+    state_ = HUNT_;
+    inPlace_ = true;
+    destLenStore_ = buf;
+    destCursor_ = buf;
+    rawStart_ = buf;
 }
 
 // -------------------------------------------------------------------------------------------------
@@ -108,8 +270,9 @@ int Rfc1662Framer::decode(const uint8_t* src, size_t len) {
     int msgCnt = 0;
     uint16_t destLen;
     size_t i;
+    const uint8_t* destEnd = dest_ + destLen_;
 
-    if (dest_ == 0) {
+    if (dest_ == 0 || inPlace_) {
         return ERR_DEST_NULL;
     }
     if (destLen_ == 0) {
@@ -134,8 +297,8 @@ int Rfc1662Framer::decode(const uint8_t* src, size_t len) {
         destCursor_ = toPtr;
     }
 
-    // This loop decodes each byte in the source buffer. It has early returns to terminate buffer
-    // overflow cases
+    // This loop decodes each byte in the source buffer. A frame that doesn't fit is dropped and
+    // decoding picks up again at the next flag, so messages already completed are kept.
     for (i = 0; i < len; ++i) {
         switch (state_) {
             case HUNT_:
@@ -149,8 +312,9 @@ int Rfc1662Framer::decode(const uint8_t* src, size_t len) {
                     state_ = DECODE_ESC_;
                 } else if (*src != FLAG) {
                     state_ = DECODE_;
-                    if (destCursor_ == dest_ + destLen_) {
-                        return ERR_DEST_OVERFLOW;
+                    if (destCursor_ >= destEnd) {
+                        dropFrame(HUNT_);
+                        break;
                     }
                     *destCursor_ = *src;
                     ++destCursor_;
@@ -160,18 +324,36 @@ int Rfc1662Framer::decode(const uint8_t* src, size_t len) {
             case DECODE_:
                 if (*src == FLAG) {
                     state_ = START_;
+                    if (fcs_ != FCS_NONE) {
+                        if (!checkFcs(destLenStore_ + NUM_LEN_BYTES,
+                                      destCursor_ - destLenStore_ - NUM_LEN_BYTES)) {
+                            destCursor_ = destLenStore_ + NUM_LEN_BYTES;
+                            break;
+                        }
+                        destCursor_ -= fcsLen_;
+                    }
                     destLen = destCursor_ - destLenStore_ - NUM_LEN_BYTES;
                     destLenStore_[0] = destLen;
                     destLenStore_[1] = destLen >> 8;
+                    if (spans_ != 0) {
+                        if ((size_t)msgCnt == maxSpans_) {
+                            dropFrame(START_);
+                            break;
+                        }
+                        spans_[msgCnt].data = destLenStore_ + NUM_LEN_BYTES;
+                        spans_[msgCnt].len = destLen;
+                    }
                     ++msgCnt;
+                    ++stats_.frames;
                     // Prepare for next message
                     destLenStore_ = destCursor_;
                     destCursor_ += NUM_LEN_BYTES;
                 } else if (*src == ESC) {
                     state_ = DECODE_ESC_;
                 } else {
-                    if (destCursor_ == dest_ + destLen_) {
-                        return ERR_DEST_OVERFLOW;
+                    if (destCursor_ >= destEnd) {
+                        dropFrame(HUNT_);
+                        break;
                     }
                     *destCursor_ = *src;
                     ++destCursor_;
@@ -183,9 +365,11 @@ int Rfc1662Framer::decode(const uint8_t* src, size_t len) {
                     // drop message, reset cursor to start of current decode destination
                     destCursor_ = destLenStore_ + NUM_LEN_BYTES;
                     state_ = START_;
+                    ++stats_.aborts;
                 } else {
-                    if (destCursor_ == dest_ + destLen_) {
-                        return ERR_DEST_OVERFLOW;
+                    if (destCursor_ >= destEnd) {
+                        dropFrame(HUNT_);
+                        break;
                     }
                     *destCursor_ = *src ^ XOR;
                     ++destCursor_;
@@ -199,9 +383,168 @@ int Rfc1662Framer::decode(const uint8_t* src, size_t len) {
     return msgCnt;
 }
 
+// -------------------------------------------------------------------------------------------------
+// Rfc1662Framer::decodeBuffer
+// -------------------------------------------------------------------------------------------------
+uint8_t* Rfc1662Framer::decodeBuffer(size_t* space) {
+    if (dest_ == 0 || !inPlace_) {
+        *space = 0;
+        return 0;
+    }
+
+    if (state_ == HUNT_ || state_ == START_) {
+        destLenStore_ = dest_;
+        destCursor_ = dest_;
+    } else {
+        // Move the in progress message to the front of the buffer
+        size_t inProgLen = destCursor_ - destLenStore_;
+        if (inProgLen == destLen_) {
+            ++stats_.overflows;
+            state_ = HUNT_;
+            inProgLen = 0;
+        } else if (destLenStore_ != dest_) {
+            memmove(dest_, destLenStore_, inProgLen);
+        }
+        destLenStore_ = dest_;
+        destCursor_ = dest_ + inProgLen;
+    }
+
+    rawStart_ = destCursor_;
+    *space = dest_ + destLen_ - destCursor_;
+    return rawStart_;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Rfc1662Framer::decodeInPlace
+// -------------------------------------------------------------------------------------------------
+int Rfc1662Framer::decodeInPlace(size_t len) {
+    const uint8_t* src = rawStart_;
+    int msgCnt = 0;
+    size_t i;
+
+    if (dest_ == 0 || !inPlace_ || spans_ == 0) {
+        return ERR_DEST_NULL;
+    }
+
+    // Same state machine as decode(), without length bytes and without a dest bound: the write
+    // cursor never passes the byte being read.
+    for (i = 0; i < len; ++i) {
+        switch (state_) {
+            case HUNT_:
+                if (*src == FLAG) {
+                    state_ = START_;
+                    destLenStore_ = destCursor_;
+                }
+                break;
+
+            case START_:
+                if (*src == ESC) {
+                    state_ = DECODE_ESC_;
+                } else if (*src != FLAG) {
+                    state_ = DECODE_;
+                    *destCursor_ = *src;
+                    ++destCursor_;
+                }
+                break;
+
+            case DECODE_:
+                if (*src == FLAG) {
+                    state_ = START_;
+                    if (fcs_ != FCS_NONE) {
+                        if (!checkFcs(destLenStore_, destCursor_ - destLenStore_)) {
+                            destCursor_ = destLenStore_;
+                            break;
+                        }
+                        destCursor_ -= fcsLen_;
+                    }
+                    if ((size_t)msgCnt == maxSpans_) {
+                        dropFrame(START_);
+                        break;
+                    }
+                    spans_[msgCnt].data = destLenStore_;
+                    spans_[msgCnt].len = destCursor_ - destLenStore_;
+                    ++msgCnt;
+                    ++stats_.frames;
+                    // Prepare for next message
+                    destLenStore_ = destCursor_;
+                } else if (*src == ESC) {
+                    state_ = DECODE_ESC_;
+                } else {
+                    *destCursor_ = *src;
+                    ++destCursor_;
+                }
+                break;
+
+            case DECODE_ESC_:
+                if (*src == FLAG) {
+                    // drop message, reset cursor to start of current decode destination
+                    destCursor_ = destLenStore_;
+                    state_ = START_;
+                    ++stats_.aborts;
+                } else {
+                    *destCursor_ = *src ^ XOR;
+                    ++destCursor_;
+                    state_ = DECODE_;
+                }
+                break;
+        }
+        ++src;
+    }
+
+    return msgCnt;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Rfc1662Framer::getStats
+// -------------------------------------------------------------------------------------------------
+void Rfc1662Framer::getStats(Rfc1662Stats_t* stats) const {
+    *stats = stats_;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Rfc1662Framer::resetStats
+// -------------------------------------------------------------------------------------------------
+void Rfc1662Framer::resetStats(void) {
+    stats_.frames = 0;
+    stats_.aborts = 0;
+    stats_.overflows = 0;
+    stats_.fcsErrors = 0;
+}
+
 // -------------------------------------------------------------------------------------------------
 // PRIVATE METHODS
 // -------------------------------------------------------------------------------------------------
 // -------------------------------------------------------------------------------------------------
-// Rfc1662Framer::<method name>
+// Rfc1662Framer::dropFrame
+// -------------------------------------------------------------------------------------------------
+// Discard the message being decoded. next is HUNT_ when the rest of the frame must be skipped,
+// START_ when the frame just ended.
 // -------------------------------------------------------------------------------------------------
+void Rfc1662Framer::dropFrame(DecodeState_t next) {
+    destCursor_ = destLenStore_ + (inPlace_ ? 0 : NUM_LEN_BYTES);
+    state_ = next;
+    ++stats_.overflows;
+}
+
+// -------------------------------------------------------------------------------------------------
+// Rfc1662Framer::checkFcs
+// -------------------------------------------------------------------------------------------------
+// Runs the CRC over the message and its trailing FCS, which leaves a fixed residue when they
+// agree. Counts the failures.
+// -------------------------------------------------------------------------------------------------
+bool Rfc1662Framer::checkFcs(const uint8_t* msg, size_t len) {
+    bool good;
+
+    if (len <= fcsLen_) {
+        good = false;
+    } else if (fcs_ == FCS_32) {
+        good = (fcs32_update(FCS32_INIT, msg, len) == FCS32_GOOD);
+    } else {
+        good = (fcs16_update(FCS16_INIT, msg, len) == FCS16_GOOD);
+    }
+
+    if (!good) {
+        ++stats_.fcsErrors;
+    }
+    return good;
+}
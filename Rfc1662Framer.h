@@ -34,6 +34,19 @@
 // =================================================================================================
 // DATA TYPES
 // =================================================================================================
+/** @brief Location of a decoded message. Valid until the next decode operation. */
+typedef struct Rfc1662Span_s {
+    const uint8_t* data; /**< First byte of the message */
+    size_t len;          /**< Message length in bytes */
+} Rfc1662Span_t;
+
+/** @brief Decoder event counts, cumulative until Rfc1662Framer::resetStats() */
+typedef struct Rfc1662Stats_s {
+    uint32_t frames;    /**< Messages decoded */
+    uint32_t aborts;    /**< Frames dropped because an escape was followed by a flag */
+    uint32_t overflows; /**< Frames dropped because they didn't fit the dest buffer or span list */
+    uint32_t fcsErrors; /**< Frames dropped because the frame check sequence didn't match */
+} Rfc1662Stats_t;
 
 // =================================================================================================
 // CLASS DEFINITION
@@ -57,14 +70,42 @@ public:
         LAST,     /**< Include the closing flag only */
     };
 
+    /** @brief Frame check sequence appended to each frame, see RFC 1662 appendix C. Both ends
+     * of the link must agree. */
+    enum Fcs_e {
+        FCS_NONE, /**< No frame check (default) */
+        FCS_16,   /**< 16-bit FCS, 2 bytes per frame */
+        FCS_32,   /**< 32-bit FCS, 4 bytes per frame */
+    };
+
     explicit Rfc1662Framer(void);
     virtual ~Rfc1662Framer(void){};
 
+    /** @brief Select the frame check sequence used by encode and decode operations.
+     *
+     * Encoding appends the FCS before the closing flag. Decoding verifies it as each frame
+     * ends, drops frames that fail (see Rfc1662Stats_t::fcsErrors) and leaves it out of the
+     * decoded message.
+     * @param fcs the frame check sequence to use
+     */
+    void setFcs(Fcs_e fcs);
+
+    /** @brief The frame check sequence in use */
+    Fcs_e fcs(void) const {
+        return fcs_;
+    }
+
+    /** @brief The largest number of bytes encode() can produce for a len byte block: every
+     * byte escaped, both flags and the escaped FCS. */
+    size_t maxEncodedLen(size_t len) const {
+        return 2 * (len + fcsLen_) + 2;
+    }
+
     /** @brief Encodes len bytes from the src buffer into the dest buffer by byte stuffing.
      * Flag bytes are prepended and appended to the message encoded in the dest buffer based on
      * the @b be paramter.
      * @param dest pointer to where to place the encoded bytes. The size of the dest buffer
-     * must be 2 * size of src buffer + 2.
+     * must be at least maxEncodedLen(len).
      * @param src pointer to the source bytes to encode
      * @param len the number of bytes to encode
      * @param be the type of block encoding to perform
@@ -73,6 +114,25 @@ public:
      */
     int encode(uint8_t* dest, const uint8_t* src, size_t len, BlockEncode_e be = COMPLETE);
 
+    /** @brief Number of bytes len bytes of src take once byte stuffed. Usable at compile time. */
+    static constexpr size_t stuffedLen(const uint8_t* src, size_t len) {
+        // 0x7E FLAG and 0x7D ESC; the class constants aren't usable in constant expressions
+        return (len == 0) ? 0
+                          : ((src[0] == 0x7E || src[0] == 0x7D) ? 2 : 1) + stuffedLen(src + 1, len - 1);
+    }
+
+    /** @brief true if frame is the complete encoding of src without FCS. For checking frames
+     * that are pre-encoded at compile time, e.g.
+     * static_assert(Rfc1662Framer::isEncodingOf(cmd, sizeof(cmd), frame, sizeof(frame)), "")
+     */
+    static constexpr bool isEncodingOf(const uint8_t* src,
+                                       size_t len,
+                                       const uint8_t* frame,
+                                       size_t frameLen) {
+        return frameLen == stuffedLen(src, len) + 2 && frame[0] == 0x7E &&
+               frame[frameLen - 1] == 0x7E && isStuffingOf(src, len, frame + 1);
+    }
+
     /** @brief Initialize the decoder. Any previously started decoding operations will be lost.
      * @param dest a pointer to a buffer where messages will be decoded to
      * @param len the length in bytes of the dest buffer
@@ -91,23 +151,74 @@ public:
      * messages may be lost. The decoder may provide more than one message in the dest buffer
      * for a single call. The decoder will decode complete messages even if they are provided
      * across multiple calls.
+     *
+     * A frame that doesn't fit in the dest buffer is dropped and counted (see getStats()). The
+     * decoder then hunts for the next flag and carries on; messages completed earlier in the
+     * same call are still returned.
      * @param src a pointer to the bytes to decode
      * @param len the number of bytes to decode
      * @return >0 number of messages in the dest buffer
      * @return 0 there are no messages in the dest buffer
      * @return -1 the dest buffer pointer has not been initialized
      * @return -2 the length of the dest buffer has not been initialized or was 0
-     * @return -3 the dest buffer overflowed during the decode operation. If the dest buffer
-     * overflows the decoder must be reinitialized.
      */
     int decode(const uint8_t* src, size_t len);
 
+    /** @brief Have decode operations also list the messages they produce.
+     *
+     * Each decode() or decodeInPlace() call starts the list over; entry i describes message i
+     * of that call. Messages that find no free entry are dropped and counted. A message
+     * takes at least 2 encoded bytes, so len / 2 + 1 entries per len bytes decoded is enough.
+     * @param spans where to list the messages, NULL to stop listing them
+     * @param maxSpans number of entries in spans
+     */
+    void decodeSpans(Rfc1662Span_t* spans, size_t maxSpans);
+
+    /** @brief Initialize the decoder to unstuff in place. Any previously started decoding
+     * operations will be lost.
+     *
+     * Encoded bytes are placed directly in the decoder's buffer (see decodeBuffer()) and
+     * unstuffed where they are, so there is no separate receive buffer to copy from. Messages
+     * are reported through the span list only, which must be set with decodeSpans().
+     * @param buf a pointer to the buffer encoded bytes are received and decoded in
+     * @param len the length in bytes of buf
+     */
+    void decodeInitInPlace(uint8_t* buf, size_t len);
+
+    /** @brief Get where the next encoded bytes for decodeInPlace() go.
+     *
+     * Moves any partially decoded message to the front of the buffer first, so messages from
+     * the previous decodeInPlace() call are no longer valid. If a partial message fills the
+     * whole buffer it is dropped and counted as an overflow.
+     * @param space receives how many bytes may be placed at the returned location
+     * @return where to place encoded bytes, NULL if not initialized with decodeInitInPlace()
+     */
+    uint8_t* decodeBuffer(size_t* space);
+
+    /** @brief Unstuff len encoded bytes placed at the location given by decodeBuffer().
+     *
+     * Decoded bytes never outnumber encoded ones, so the output can't overtake the input.
+     * @param len the number of bytes placed
+     * @return >=0 number of messages listed in the span list
+     * @return -1 not initialized with decodeInitInPlace() or no span list set
+     */
+    int decodeInPlace(size_t len);
+
+    /** @brief Get the decoder event counts. They are not cleared by decodeInit().
+     * @param stats receives the counts
+     */
+    void getStats(Rfc1662Stats_t* stats) const;
+
+    /** @brief Clear the decoder event counts. */
+    void resetStats(void);
+
     static const uint8_t FLAG;               /**< Start/end flag */
     static const uint8_t ESC;                /**< Escape character */
     static const uint8_t XOR;                /**< Exclusive OR character */
     static const int ERR_DEST_NULL;          /**< Decoder destination buffer is null */
     static const int ERR_DEST_LEN_ZERO;      /**< Destination buffer length is 0 */
-    static const int ERR_DEST_OVERFLOW;      /**< Destination buffer overflowed */
+    static const int ERR_DEST_OVERFLOW;      /**< Destination buffer overflowed (no longer
+                                              * returned, overflowing frames are dropped) */
     static const unsigned int NUM_LEN_BYTES; /**< Number of bytes in the length field in the
                                               * decoder dest buffer */
 
@@ -125,5 +236,25 @@ private:
     size_t destLen_;
     uint8_t* destCursor_;   // Where to store the next byte in the dest buffer
     uint8_t* destLenStore_; // Where to store the length of the message currently being decoded
+                            // (in place: where the message currently being decoded starts)
+    bool inPlace_;
+    uint8_t* rawStart_; // In place: where decodeBuffer() asked for encoded bytes
+    Rfc1662Span_t* spans_;
+    size_t maxSpans_;
+
+    static constexpr bool isStuffingOf(const uint8_t* src, size_t len, const uint8_t* out) {
+        return (len == 0) ? true
+               : (src[0] == 0x7E || src[0] == 0x7D)
+                       ? (out[0] == 0x7D && out[1] == (src[0] ^ 0x20) &&
+                          isStuffingOf(src + 1, len - 1, out + 2))
+                       : (out[0] == src[0] && isStuffingOf(src + 1, len - 1, out + 1));
+    }
+
+    void dropFrame(DecodeState_t next);
+    bool checkFcs(const uint8_t* msg, size_t len);
+    Rfc1662Stats_t stats_;
+    Fcs_e fcs_;
+    size_t fcsLen_;
+    uint32_t encodeCrc_; // FCS accumulated over the blocks of the frame being encoded
 };
 #endif // RFC_1662_FRAMER_H
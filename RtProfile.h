@@ -0,0 +1,88 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RT_PROFILE_H
+#define RT_PROFILE_H
+
+/** @file @brief Real-time execution profile for threads servicing the HAL.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include <stddef.h>
+#include <stdint.h>
+
+// =================================================================================================
+// CLASS DEFINITION - RtProfile
+// =================================================================================================
+/** @brief Scheduling, CPU affinity and memory locking settings for a thread.
+ *
+ * Fields left at their defaults are not touched when the profile is applied.
+ */
+class RtProfile {
+public:
+    enum Policy_e {
+        POLICY_DEFAULT, /**< Leave the scheduling policy alone */
+        POLICY_OTHER,   /**< Normal time sharing */
+        POLICY_FIFO,    /**< Real-time, run until blocked or preempted by higher priority */
+        POLICY_RR,      /**< Real-time, round robin between equal priorities */
+    };
+
+    /** @brief Bits in the failed mask reported by apply() */
+    enum Failure_e {
+        FAIL_SCHED = 0x01,    /**< Policy/priority not applied */
+        FAIL_AFFINITY = 0x02, /**< CPU affinity not applied */
+        FAIL_MLOCK = 0x04,    /**< Memory could not be locked */
+    };
+
+    explicit RtProfile(void)
+        : policy(POLICY_DEFAULT)
+        , priority(0)
+        , cpuMask(0)
+        , perDeviceCpu(false)
+        , lockMemory(false)
+        , prefaultStackBytes(0){};
+
+    Policy_e policy;           /**< Scheduling policy */
+    int priority;              /**< Priority for POLICY_FIFO/POLICY_RR (1..99 on Linux) */
+    uint64_t cpuMask;          /**< CPUs the thread may run on, 0 to leave affinity alone */
+    bool perDeviceCpu;         /**< Pin each device to one CPU of cpuMask, see forDevice() */
+    bool lockMemory;           /**< Lock current and future process memory (mlockall) */
+    size_t prefaultStackBytes; /**< Bytes of stack to touch so they are resident */
+
+    /** @brief Derive the profile for one device on a multi-hub host.
+     *
+     * With perDeviceCpu set the result is pinned to a single CPU, chosen round robin from
+     * cpuMask by device index, so each hub gets its own core. Otherwise returns a copy.
+     */
+    RtProfile forDevice(int deviceIdx) const;
+
+    /** @brief Apply the profile to the calling thread.
+     *
+     * Every requested setting is attempted. Failures, including missing privileges, are
+     * reported on stderr.
+     * @param failed optional, receives a mask of Failure_e for the settings not applied
+     * @return 0 if everything was applied, -1 otherwise
+     */
+    int apply(unsigned* failed = 0) const;
+
+    /** @brief Touch every page of a buffer so it is resident (and locked, if memory is). */
+    static void prefault(void* buf, size_t len);
+};
+
+#endif // RT_PROFILE_H
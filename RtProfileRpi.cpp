@@ -0,0 +1,161 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "RtProfile.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <alloca.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define PREFAULT_STACK_PAGE 4096
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+// Touch one byte per page of the next bytes of stack, all in this one frame. Not inlined, so
+// the region is below the caller's frame and is given back when this returns, faulted in.
+static __attribute__((noinline)) void prefault_stack(size_t bytes) {
+    volatile uint8_t* stack = (volatile uint8_t*)alloca(bytes);
+    for (size_t i = 0; i < bytes; i += PREFAULT_STACK_PAGE) {
+        stack[i] = 0;
+    }
+    if (bytes > 0) {
+        stack[bytes - 1] = 0;
+    }
+}
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - RtProfile
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// RtProfile::forDevice
+// -------------------------------------------------------------------------------------------------
+RtProfile RtProfile::forDevice(int deviceIdx) const {
+    RtProfile p = *this;
+
+    if (perDeviceCpu && cpuMask != 0) {
+        int nCpus = __builtin_popcountll(cpuMask);
+        int pick = deviceIdx % nCpus;
+        uint64_t mask = cpuMask;
+        for (int i = 0; i < pick; i++) {
+            mask &= mask - 1; // drop lowest set bit
+        }
+        p.cpuMask = mask & ~(mask - 1);
+    }
+
+    return p;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RtProfile::apply
+// -------------------------------------------------------------------------------------------------
+int RtProfile::apply(unsigned* failed) const {
+    unsigned fail = 0;
+    int err;
+
+    if (lockMemory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            fprintf(stderr,
+                    "RtProfile: mlockall failed: %s%s\n",
+                    strerror(errno),
+                    (errno == EPERM || errno == ENOMEM)
+                            ? " (needs CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK)"
+                            : "");
+            fail |= FAIL_MLOCK;
+        }
+    }
+
+    if (cpuMask != 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < 64; cpu++) {
+            if (cpuMask & (1ULL << cpu)) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            fprintf(stderr,
+                    "RtProfile: unable to set CPU affinity 0x%llx: %s\n",
+                    (unsigned long long)cpuMask,
+                    strerror(err));
+            fail |= FAIL_AFFINITY;
+        }
+    }
+
+    if (policy != POLICY_DEFAULT) {
+        struct sched_param param;
+        int sched = SCHED_OTHER;
+        memset(&param, 0, sizeof(param));
+        if (policy == POLICY_FIFO) {
+            sched = SCHED_FIFO;
+        } else if (policy == POLICY_RR) {
+            sched = SCHED_RR;
+        }
+        if (sched != SCHED_OTHER) {
+            param.sched_priority = priority;
+        }
+        err = pthread_setschedparam(pthread_self(), sched, &param);
+        if (err != 0) {
+            fprintf(stderr,
+                    "RtProfile: unable to set scheduling policy %d priority %d: %s%s\n",
+                    sched,
+                    param.sched_priority,
+                    strerror(err),
+                    (err == EPERM) ? " (needs CAP_SYS_NICE or RLIMIT_RTPRIO)" : "");
+            fail |= FAIL_SCHED;
+        }
+    }
+
+    if (prefaultStackBytes > 0) {
+        prefault_stack(prefaultStackBytes);
+    }
+
+    if (failed != 0) {
+        *failed = fail;
+    }
+    return (fail == 0) ? 0 : -1;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RtProfile::prefault
+// -------------------------------------------------------------------------------------------------
+void RtProfile::prefault(void* buf, size_t len) {
+    volatile uint8_t* p = (volatile uint8_t*)buf;
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (len == 0) {
+        return;
+    }
+
+    // Write back what is there so the page is faulted in writable without changing contents
+    for (size_t i = 0; i < len; i += pageSize) {
+        p[i] = p[i];
+    }
+    p[len - 1] = p[len - 1];
+}
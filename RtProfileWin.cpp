@@ -0,0 +1,135 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "RtProfile.h"
+
+#include <Windows.h>
+#include <malloc.h>
+#include <stdio.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define PREFAULT_STACK_PAGE 4096
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+// One frame for the whole region: _alloca probes each page in order, growing the committed
+// stack past the guard page, then every page is touched
+static __declspec(noinline) void prefault_stack(size_t bytes) {
+    volatile uint8_t* stack = (volatile uint8_t*)_alloca(bytes);
+    for (size_t i = 0; i < bytes; i += PREFAULT_STACK_PAGE) {
+        stack[i] = 0;
+    }
+    if (bytes > 0) {
+        stack[bytes - 1] = 0;
+    }
+}
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - RtProfile
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// RtProfile::forDevice
+// -------------------------------------------------------------------------------------------------
+RtProfile RtProfile::forDevice(int deviceIdx) const {
+    RtProfile p = *this;
+
+    if (perDeviceCpu && cpuMask != 0) {
+        int nCpus = 0;
+        for (uint64_t m = cpuMask; m != 0; m &= m - 1) {
+            nCpus++;
+        }
+        int pick = deviceIdx % nCpus;
+        uint64_t mask = cpuMask;
+        for (int i = 0; i < pick; i++) {
+            mask &= mask - 1; // drop lowest set bit
+        }
+        p.cpuMask = mask & ~(mask - 1);
+    }
+
+    return p;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RtProfile::apply
+// -------------------------------------------------------------------------------------------------
+// Windows has no per-thread equivalent of mlockall, so lockMemory only grows the working set
+// minimum; buffers that matter are made resident with prefault().
+// -------------------------------------------------------------------------------------------------
+int RtProfile::apply(unsigned* failed) const {
+    unsigned fail = 0;
+
+    if (lockMemory) {
+        if (!SetProcessWorkingSetSize(GetCurrentProcess(), 16 * 1024 * 1024, 64 * 1024 * 1024)) {
+            fprintf(stderr, "RtProfile: unable to grow working set (%lu)\n", GetLastError());
+            fail |= FAIL_MLOCK;
+        }
+    }
+
+    if (cpuMask != 0) {
+        if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)cpuMask) == 0) {
+            fprintf(stderr,
+                    "RtProfile: unable to set CPU affinity 0x%llx (%lu)\n",
+                    (unsigned long long)cpuMask,
+                    GetLastError());
+            fail |= FAIL_AFFINITY;
+        }
+    }
+
+    if (policy != POLICY_DEFAULT) {
+        int prio = THREAD_PRIORITY_NORMAL;
+        if (policy == POLICY_FIFO || policy == POLICY_RR) {
+            prio = (priority >= 50) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+        }
+        if (!SetThreadPriority(GetCurrentThread(), prio)) {
+            fprintf(stderr, "RtProfile: unable to set thread priority (%lu)\n", GetLastError());
+            fail |= FAIL_SCHED;
+        }
+    }
+
+    if (prefaultStackBytes > 0) {
+        prefault_stack(prefaultStackBytes);
+    }
+
+    if (failed != 0) {
+        *failed = fail;
+    }
+    return (fail == 0) ? 0 : -1;
+}
+
+// -------------------------------------------------------------------------------------------------
+// RtProfile::prefault
+// -------------------------------------------------------------------------------------------------
+void RtProfile::prefault(void* buf, size_t len) {
+    volatile uint8_t* p = (volatile uint8_t*)buf;
+
+    if (len == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < len; i += 4096) {
+        p[i] = p[i];
+    }
+    p[len - 1] = p[len - 1];
+
+    VirtualLock(buf, len);
+}
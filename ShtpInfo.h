@@ -0,0 +1,56 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHTP_INFO_H
+#define SHTP_INFO_H
+
+/** @file @brief SHTP header fields of received messages, shared by the HAL and its helpers.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include <stdint.h>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define SHTP_MAX_CHANNELS 8
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+// SHTP header of a received message, parsed as it comes out of the decoder
+typedef struct ShtpMsgInfo_s {
+    uint16_t length;     // SHTP length field, header included, continuation bit removed
+    uint8_t channel;     // 0xFF if the message isn't SHTP (bad UART header or too short)
+    uint8_t seq;         // Sequence number
+    bool continuation;   // Continuation bit of the length field
+    bool lengthMismatch; // Length field disagrees with the bytes received
+    uint8_t lost;        // Messages missing on this channel just before this one
+} ShtpMsgInfo_t;
+
+// Per channel receive accounting, see FtdiHal::getShtpStats
+typedef struct ShtpChannelStats_s {
+    uint32_t messages;         // Messages received
+    uint32_t gaps;             // Sequence discontinuities
+    uint32_t lost;             // Messages missing according to the sequence numbers
+    uint32_t lengthMismatches; // Length field disagreed with the bytes received
+    uint32_t filtered;         // Dropped by the report filter, see FtdiHal::setReportFilter
+} ShtpChannelStats_t;
+
+#endif // SHTP_INFO_H
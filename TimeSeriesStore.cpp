@@ -0,0 +1,240 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "TimeSeriesStore.h"
+
+#include <string.h>
+
+// =================================================================================================
+// PUBLIC FUNCTIONS - TimeSeriesStore
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::TimeSeriesStore
+// -------------------------------------------------------------------------------------------------
+TimeSeriesStore::TimeSeriesStore(void) : lastStamp_us_(0), haveStamp_(false) {
+    for (unsigned i = 0; i < 256; i++) {
+        series_[i].capacity = 0;
+        series_[i].head = 0;
+        series_[i].count = 0;
+        series_[i].columns = 0;
+        series_[i].reportLen = 0;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::enable
+// -------------------------------------------------------------------------------------------------
+int TimeSeriesStore::enable(uint8_t sensorId, size_t capacity) {
+    unsigned columns = ReportBatch::columns(sensorId);
+    if (columns == 0 || capacity == 0) {
+        return -1;
+    }
+
+    Series_t& s = series_[sensorId];
+    s.capacity = capacity;
+    s.head = 0;
+    s.count = 0;
+    s.columns = columns;
+    s.reportLen = ReportBatch::reportLen(sensorId);
+    s.t_us.assign(capacity, 0);
+    for (unsigned c = 0; c < REPORT_BATCH_MAX_COLUMNS; c++) {
+        std::vector<float> column(c < columns ? capacity : 0);
+        s.data[c].swap(column);
+    }
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::disable
+// -------------------------------------------------------------------------------------------------
+void TimeSeriesStore::disable(uint8_t sensorId) {
+    Series_t& s = series_[sensorId];
+    s.capacity = 0;
+    s.head = 0;
+    s.count = 0;
+    s.columns = 0;
+    s.reportLen = 0;
+    std::vector<uint64_t>().swap(s.t_us);
+    for (unsigned c = 0; c < REPORT_BATCH_MAX_COLUMNS; c++) {
+        std::vector<float>().swap(s.data[c]);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::onReport
+// -------------------------------------------------------------------------------------------------
+void TimeSeriesStore::onReport(const uint8_t* report, size_t len, uint32_t t_us) {
+    // Extend every receive time, stored or not, so no wrap goes unseen between reports
+    if (!haveStamp_) {
+        lastStamp_us_ = t_us;
+        haveStamp_ = true;
+    } else {
+        lastStamp_us_ += (uint32_t)(t_us - (uint32_t)lastStamp_us_);
+    }
+
+    Series_t& s = series_[report[0]];
+    if (s.capacity == 0 || len < s.reportLen) {
+        return; // Not kept, or cut short (gyro integrated RV payloads vary in length)
+    }
+
+    size_t slot = s.head + s.count;
+    if (slot >= s.capacity) {
+        slot -= s.capacity;
+    }
+
+    float value[REPORT_BATCH_MAX_COLUMNS];
+    float* out[REPORT_BATCH_MAX_COLUMNS];
+    for (unsigned c = 0; c < s.columns; c++) {
+        out[c] = &value[c];
+    }
+    ReportBatch::decode(report[0], report, 0, 1, out);
+
+    s.t_us[slot] = lastStamp_us_;
+    for (unsigned c = 0; c < s.columns; c++) {
+        s.data[c][slot] = value[c];
+    }
+
+    if (s.count < s.capacity) {
+        s.count++;
+    } else if (++s.head == s.capacity) {
+        s.head = 0; // Full, the oldest sample went
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::range
+// -------------------------------------------------------------------------------------------------
+size_t TimeSeriesStore::range(uint8_t sensorId,
+                              uint64_t from_us,
+                              uint64_t to_us,
+                              SeriesSpan_t spans[2]) const {
+    const Series_t& s = series_[sensorId];
+    if (to_us < from_us) {
+        to_us = from_us;
+    }
+
+    size_t first = LowerBound(s, from_us);
+    size_t end = LowerBound(s, to_us);
+    return Spans(s, first, end - first, spans);
+}
+
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::last
+// -------------------------------------------------------------------------------------------------
+size_t TimeSeriesStore::last(uint8_t sensorId, size_t n, SeriesSpan_t spans[2]) const {
+    const Series_t& s = series_[sensorId];
+    if (n > s.count) {
+        n = s.count;
+    }
+    return Spans(s, s.count - n, n, spans);
+}
+
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::size
+// -------------------------------------------------------------------------------------------------
+size_t TimeSeriesStore::size(uint8_t sensorId) const {
+    return series_[sensorId].count;
+}
+
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::newest_us
+// -------------------------------------------------------------------------------------------------
+uint64_t TimeSeriesStore::newest_us(uint8_t sensorId) const {
+    const Series_t& s = series_[sensorId];
+    if (s.count == 0) {
+        return 0;
+    }
+
+    size_t slot = s.head + s.count - 1;
+    return s.t_us[slot < s.capacity ? slot : slot - s.capacity];
+}
+
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::clear
+// -------------------------------------------------------------------------------------------------
+void TimeSeriesStore::clear(void) {
+    for (unsigned i = 0; i < 256; i++) {
+        series_[i].head = 0;
+        series_[i].count = 0;
+    }
+    haveStamp_ = false;
+}
+
+// =================================================================================================
+// PRIVATE FUNCTIONS
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::LowerBound
+// -------------------------------------------------------------------------------------------------
+// Index, counted from the oldest sample, of the first sample at or after t_us
+// -------------------------------------------------------------------------------------------------
+size_t TimeSeriesStore::LowerBound(const Series_t& s, uint64_t t_us) const {
+    size_t lo = 0;
+    size_t hi = s.count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t slot = s.head + mid;
+        if (slot >= s.capacity) {
+            slot -= s.capacity;
+        }
+        if (s.t_us[slot] < t_us) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// -------------------------------------------------------------------------------------------------
+// TimeSeriesStore::Spans
+// -------------------------------------------------------------------------------------------------
+// n samples starting first samples after the oldest, split where the ring wraps
+// -------------------------------------------------------------------------------------------------
+size_t TimeSeriesStore::Spans(const Series_t& s, size_t first, size_t n, SeriesSpan_t spans[2]) const {
+    memset(spans, 0, 2 * sizeof(SeriesSpan_t));
+    if (n == 0) {
+        return 0;
+    }
+
+    size_t start = s.head + first;
+    if (start >= s.capacity) {
+        start -= s.capacity;
+    }
+    size_t firstLen = s.capacity - start;
+    if (firstLen > n) {
+        firstLen = n;
+    }
+
+    spans[0].t_us = &s.t_us[start];
+    spans[0].len = firstLen;
+    if (n > firstLen) {
+        spans[1].t_us = &s.t_us[0];
+        spans[1].len = n - firstLen;
+    }
+    for (unsigned c = 0; c < s.columns; c++) {
+        spans[0].column[c] = &s.data[c][start];
+        if (n > firstLen) {
+            spans[1].column[c] = &s.data[c][0];
+        }
+    }
+    return n;
+}
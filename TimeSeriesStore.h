@@ -0,0 +1,113 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIME_SERIES_STORE_H
+#define TIME_SERIES_STORE_H
+
+/** @file @brief Recent decoded sensor data kept in columns, for windowed analysis.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "ReportBatch.h"
+#include "ReportSink.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+/** @brief A run of consecutive samples, pointing into the store. A ring wraps, so a query can
+ * take two of these; the first one holds the older samples. */
+typedef struct SeriesSpan_s {
+    const uint64_t* t_us;                          /**< Receive timestamps, nondecreasing */
+    const float* column[REPORT_BATCH_MAX_COLUMNS]; /**< One per field, see ReportBatch */
+    size_t len;                                    /**< Samples in the run */
+} SeriesSpan_t;
+
+// =================================================================================================
+// CLASS DEFINITION - TimeSeriesStore
+// =================================================================================================
+/** @brief Ring buffers of decoded samples, one per enabled sensor, in structure of arrays form.
+ *
+ * Fed through ReportSink (see FtdiHal::addReportSink()): each report of an enabled sensor is
+ * decoded once with ReportBatch and appended as a timestamp plus one float per field. Queries
+ * find a time window by binary search and hand back spans into the columns, so analysis runs
+ * over contiguous arrays without copying or allocating. Memory is allocated by enable() only.
+ *
+ * Timestamps are the HAL's 32-bit receive times extended to 64 bits across wraps.
+ *
+ * Spans stay valid until the samples they cover are overwritten, i.e. until capacity more
+ * reports of that sensor arrive. Not thread safe; query from the thread reading the HAL (e.g.
+ * between read() calls or from service() callbacks), or serialize access.
+ */
+class TimeSeriesStore : public ReportSink {
+public:
+    TimeSeriesStore(void);
+
+    /** @brief Start keeping the last capacity samples of a sensor. Drops what it held.
+     * @return 0 on success, -1 if ReportBatch can't decode the sensor or capacity is 0
+     */
+    int enable(uint8_t sensorId, size_t capacity);
+
+    /** @brief Stop keeping a sensor and free its buffers */
+    void disable(uint8_t sensorId);
+
+    virtual void onReport(const uint8_t* report, size_t len, uint32_t t_us);
+
+    /** @brief Samples received from from_us up to, not including, to_us.
+     * @param spans receive the samples, older run first; spans[1].len is 0 unless the window
+     * wraps around the end of the ring
+     * @return number of samples in the window
+     */
+    size_t range(uint8_t sensorId, uint64_t from_us, uint64_t to_us, SeriesSpan_t spans[2]) const;
+
+    /** @brief The last n samples, or all of them if fewer are held. Spans as range(). */
+    size_t last(uint8_t sensorId, size_t n, SeriesSpan_t spans[2]) const;
+
+    /** @brief Samples held for a sensor */
+    size_t size(uint8_t sensorId) const;
+
+    /** @brief Timestamp of the newest sample, 0 if none */
+    uint64_t newest_us(uint8_t sensorId) const;
+
+    /** @brief Drop every sample, keeping the sensors enabled */
+    void clear(void);
+
+private:
+    typedef struct Series_s {
+        size_t capacity; // 0 when the sensor isn't enabled
+        size_t head;     // Oldest sample
+        size_t count;
+        unsigned columns;
+        size_t reportLen; // Shortest report that can be decoded
+        std::vector<uint64_t> t_us;
+        std::vector<float> data[REPORT_BATCH_MAX_COLUMNS];
+    } Series_t;
+
+    size_t LowerBound(const Series_t& s, uint64_t t_us) const;
+    size_t Spans(const Series_t& s, size_t first, size_t n, SeriesSpan_t spans[2]) const;
+
+    Series_t series_[256];
+    uint64_t lastStamp_us_; // Extended receive time of the last report
+    bool haveStamp_;
+};
+
+#endif // TIME_SERIES_STORE_H
@@ -0,0 +1,553 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "UringTransport.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define UD_TIMEOUT 0 // user_data of pacing / link timeout operations
+#define UD_IO 1      // user_data of read / write operations
+#define UD_POLL 2    // user_data of the RX readiness poll
+
+#define TX_MAX_RETRIES 3 // Submissions in a row that may fail without sending anything
+
+// Task work from linked requests otherwise runs with TIF_NOTIFY_SIGNAL set, which makes the tty
+// layer fail reads and writes with -EINTR. Deferred task work runs in io_uring_enter instead.
+#ifndef IORING_SETUP_SINGLE_ISSUER
+#define IORING_SETUP_SINGLE_ISSUER (1U << 12)
+#endif
+#ifndef IORING_SETUP_DEFER_TASKRUN
+#define IORING_SETUP_DEFER_TASKRUN (1U << 13)
+#endif
+
+#define FIXED_FD_IDX 0
+#define FIXED_BUF_IDX 0
+
+// =================================================================================================
+// CLASS CONSTANTS
+// =================================================================================================
+const unsigned int UringTransport::RING_ENTRIES = 128;
+const size_t UringTransport::TX_STAGING_LEN = 4096;
+
+#ifdef HAVE_LINUX_IO_URING_H
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+struct UringRing {
+    int fd;
+    bool enabled; // IORING_REGISTER_ENABLE_RINGS done, submitter thread bound
+
+    // Submission queue
+    void* sqMap;
+    size_t sqMapLen;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    size_t sqesLen;
+
+    // Completion queue
+    void* cqMap;
+    size_t cqMapLen;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    unsigned sqLocalTail; // Tail of SQEs prepared but not yet published
+};
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+static void ringDestroy(UringRing* r) {
+    if (r == 0) {
+        return;
+    }
+    if (r->sqes != 0) {
+        munmap(r->sqes, r->sqesLen);
+    }
+    if (r->cqMap != 0 && r->cqMap != r->sqMap) {
+        munmap(r->cqMap, r->cqMapLen);
+    }
+    if (r->sqMap != 0) {
+        munmap(r->sqMap, r->sqMapLen);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    free(r);
+}
+
+// Create a disabled ring with the tty as fixed file 0 and one fixed buffer
+static UringRing* ringCreate(int ttyFd, void* buf, size_t bufLen, int* err) {
+    struct io_uring_params params;
+    UringRing* r;
+
+    r = (UringRing*)calloc(1, sizeof(UringRing));
+    if (r == 0) {
+        *err = -ENOMEM;
+        return 0;
+    }
+
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_R_DISABLED | IORING_SETUP_SINGLE_ISSUER |
+                   IORING_SETUP_DEFER_TASKRUN;
+    r->fd = sys_io_uring_setup(UringTransport::RING_ENTRIES, &params);
+    if (r->fd < 0) {
+        *err = -errno;
+        r->fd = -1;
+        ringDestroy(r);
+        return 0;
+    }
+
+    // Map the rings. Kernels with IORING_FEAT_SINGLE_MMAP share one mapping for SQ and CQ.
+    r->sqMapLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cqMapLen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && r->cqMapLen > r->sqMapLen) {
+        r->sqMapLen = r->cqMapLen;
+    }
+
+    r->sqMap = mmap(NULL,
+                    r->sqMapLen,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE,
+                    r->fd,
+                    IORING_OFF_SQ_RING);
+    if (r->sqMap == MAP_FAILED) {
+        r->sqMap = 0;
+        *err = -errno;
+        ringDestroy(r);
+        return 0;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cqMap = r->sqMap;
+    } else {
+        r->cqMap = mmap(NULL,
+                        r->cqMapLen,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        r->fd,
+                        IORING_OFF_CQ_RING);
+        if (r->cqMap == MAP_FAILED) {
+            r->cqMap = 0;
+            *err = -errno;
+            ringDestroy(r);
+            return 0;
+        }
+    }
+
+    r->sqesLen = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL,
+                                         r->sqesLen,
+                                         PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE,
+                                         r->fd,
+                                         IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = 0;
+        *err = -errno;
+        ringDestroy(r);
+        return 0;
+    }
+
+    uint8_t* sq = (uint8_t*)r->sqMap;
+    r->sqHead = (unsigned*)(sq + params.sq_off.head);
+    r->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    r->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    r->sqArray = (unsigned*)(sq + params.sq_off.array);
+    r->sqLocalTail = *r->sqTail;
+
+    uint8_t* cq = (uint8_t*)r->cqMap;
+    r->cqHead = (unsigned*)(cq + params.cq_off.head);
+    r->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    r->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = bufLen;
+    if (sys_io_uring_register(r->fd, IORING_REGISTER_FILES, &ttyFd, 1) < 0 ||
+        sys_io_uring_register(r->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+        *err = -errno;
+        ringDestroy(r);
+        return 0;
+    }
+
+    return r;
+}
+
+// Bind the ring to the calling thread on first use
+static int ringEnable(UringRing* r) {
+    if (!r->enabled) {
+        if (sys_io_uring_register(r->fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0) {
+            return -errno;
+        }
+        r->enabled = true;
+    }
+    return 0;
+}
+
+static struct io_uring_sqe* getSqe(UringRing* r) {
+    unsigned head = __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+    unsigned next = r->sqLocalTail + 1;
+    if (next - head > *r->sqMask + 1) {
+        return NULL;
+    }
+    struct io_uring_sqe* sqe = &r->sqes[r->sqLocalTail & *r->sqMask];
+    r->sqArray[r->sqLocalTail & *r->sqMask] = r->sqLocalTail & *r->sqMask;
+    r->sqLocalTail = next;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static int submitAndWait(UringRing* r, unsigned toSubmit, unsigned waitFor) {
+    __atomic_store_n(r->sqTail, r->sqLocalTail, __ATOMIC_RELEASE);
+
+    while (true) {
+        unsigned ready = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE) - *r->cqHead;
+        if (toSubmit == 0 && ready >= waitFor) {
+            return 0;
+        }
+        unsigned minComplete = (ready < waitFor) ? waitFor - ready : 0;
+        int rc = sys_io_uring_enter(r->fd, toSubmit, minComplete, IORING_ENTER_GETEVENTS);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (toSubmit > 0) {
+                // Nothing was consumed, drop the prepared entries
+                r->sqLocalTail -= toSubmit;
+                __atomic_store_n(r->sqTail, r->sqLocalTail, __ATOMIC_RELEASE);
+            }
+            return -errno;
+        }
+        toSubmit -= ((unsigned)rc < toSubmit) ? (unsigned)rc : toSubmit;
+    }
+}
+
+static void reapCompletion(UringRing* r, uint64_t* userData, int32_t* res) {
+    unsigned head = *r->cqHead;
+    struct io_uring_cqe* cqe = &r->cqes[head & *r->cqMask];
+    *userData = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cqHead, head + 1, __ATOMIC_RELEASE);
+}
+
+static void prepTimeout(struct io_uring_sqe* sqe,
+                        uint8_t opcode,
+                        const struct __kernel_timespec* ts) {
+    sqe->opcode = opcode;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)ts;
+    sqe->len = 1;
+    sqe->user_data = UD_TIMEOUT;
+}
+
+static void prepFixedIo(struct io_uring_sqe* sqe, uint8_t opcode, const uint8_t* buf, size_t len) {
+    sqe->opcode = opcode;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = FIXED_FD_IDX;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->off = (uint64_t)-1; // tty: use (and ignore) the current file position
+    sqe->buf_index = FIXED_BUF_IDX;
+    sqe->user_data = UD_IO;
+}
+#else
+struct UringRing {};
+#endif
+
+// =================================================================================================
+// CLASS DEFINITION
+// =================================================================================================
+// -------------------------------------------------------------------------------------------------
+// PUBLIC METHODS
+// -------------------------------------------------------------------------------------------------
+// -------------------------------------------------------------------------------------------------
+// UringTransport::UringTransport
+// -------------------------------------------------------------------------------------------------
+UringTransport::UringTransport(void) : rx_(0), tx_(0), rxBuf_(0), rxLen_(0), txBuf_(0) {
+}
+
+// -------------------------------------------------------------------------------------------------
+// UringTransport::~UringTransport
+// -------------------------------------------------------------------------------------------------
+UringTransport::~UringTransport(void) {
+    close();
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+// -------------------------------------------------------------------------------------------------
+// UringTransport::init
+// -------------------------------------------------------------------------------------------------
+int UringTransport::init(int fd, uint8_t* rxBuf, size_t rxLen) {
+    int err = 0;
+
+    close();
+
+    txBuf_ = (uint8_t*)malloc(TX_STAGING_LEN);
+    if (txBuf_ == 0) {
+        return -ENOMEM;
+    }
+
+    tx_ = ringCreate(fd, txBuf_, TX_STAGING_LEN, &err);
+    if (tx_ != 0) {
+        rx_ = ringCreate(fd, rxBuf, rxLen, &err);
+    }
+    if (rx_ == 0) {
+        close();
+        return err;
+    }
+
+    rxBuf_ = rxBuf;
+    rxLen_ = rxLen;
+
+    return 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// UringTransport::close
+// -------------------------------------------------------------------------------------------------
+void UringTransport::close(void) {
+    ringDestroy(rx_);
+    rx_ = 0;
+    ringDestroy(tx_);
+    tx_ = 0;
+    free(txBuf_);
+    txBuf_ = 0;
+    rxBuf_ = 0;
+    rxLen_ = 0;
+}
+
+// -------------------------------------------------------------------------------------------------
+// UringTransport::read
+// -------------------------------------------------------------------------------------------------
+int UringTransport::read(size_t len, uint32_t timeout_us, size_t offset) {
+    struct __kernel_timespec ts;
+    struct io_uring_sqe* sqe;
+    int bytesRead = 0;
+    int err = 0;
+
+    if (!isActive()) {
+        return -EBADF;
+    }
+    err = ringEnable(rx_);
+    if (err < 0) {
+        return err;
+    }
+    if (offset >= rxLen_) {
+        return -EINVAL;
+    }
+    if (len > rxLen_ - offset) {
+        len = rxLen_ - offset;
+    }
+
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (long long)(timeout_us % 1000000) * 1000;
+
+    // POLL_ADD -> LINK_TIMEOUT -> READ_FIXED: the timeout bounds the wait for data and the read
+    // then completes inline on the O_NONBLOCK descriptor.
+    sqe = getSqe(rx_);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    sqe->fd = FIXED_FD_IDX;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = UD_POLL;
+
+    sqe = getSqe(rx_);
+    prepTimeout(sqe, IORING_OP_LINK_TIMEOUT, &ts);
+    sqe->flags |= IOSQE_IO_LINK;
+
+    sqe = getSqe(rx_);
+    prepFixedIo(sqe, IORING_OP_READ_FIXED, rxBuf_ + offset, len);
+
+    err = submitAndWait(rx_, 3, 3);
+    if (err < 0) {
+        return err;
+    }
+
+    bool hungUp = false;
+    for (int i = 0; i < 3; i++) {
+        uint64_t userData;
+        int32_t res;
+        reapCompletion(rx_, &userData, &res);
+        if (userData == UD_IO) {
+            if (res >= 0) {
+                bytesRead = res;
+            } else if (res != -ECANCELED && res != -EINTR && res != -EAGAIN) {
+                err = res;
+            }
+        } else if (userData == UD_POLL && res > 0 && (res & (POLLHUP | POLLERR))) {
+            hungUp = true;
+        }
+    }
+
+    // A hung up tty polls readable and reads empty, which would otherwise look like a timeout
+    if (err == 0 && bytesRead == 0 && hungUp) {
+        err = -EIO;
+    }
+
+    return (err < 0) ? err : bytesRead;
+}
+
+// -------------------------------------------------------------------------------------------------
+// UringTransport::writePaced
+// -------------------------------------------------------------------------------------------------
+int UringTransport::writePaced(const uint8_t* bytes, size_t len, size_t chunkLen, uint32_t gap_us) {
+    struct __kernel_timespec ts;
+    size_t written = 0;
+    unsigned retries = 0;
+    int err = 0;
+
+    if (!isActive()) {
+        return -EBADF;
+    }
+    err = ringEnable(tx_);
+    if (err < 0) {
+        return err;
+    }
+    if (chunkLen == 0) {
+        chunkLen = 1;
+    }
+
+    ts.tv_sec = gap_us / 1000000;
+    ts.tv_nsec = (long long)(gap_us % 1000000) * 1000;
+
+    const unsigned sqesPerChunk = (gap_us > 0) ? 2 : 1;
+
+    while (written < len && err == 0) {
+        // Stage as much as fits in both the registered buffer and the submission queue
+        size_t batchLen = len - written;
+        if (batchLen > TX_STAGING_LEN) {
+            batchLen = TX_STAGING_LEN;
+        }
+        size_t maxChunks = RING_ENTRIES / sqesPerChunk;
+        if ((batchLen + chunkLen - 1) / chunkLen > maxChunks) {
+            batchLen = maxChunks * chunkLen;
+        }
+        memcpy(txBuf_, bytes + written, batchLen);
+
+        // TIMEOUT -> WRITE -> TIMEOUT -> WRITE ... A pacing timeout always completes with -ETIME,
+        // so it is hard linked to keep the chain going. Writes use a normal link so a failed
+        // write cancels the rest of the frame and the successful writes stay a contiguous prefix.
+        unsigned nSqe = 0;
+        for (size_t offset = 0; offset < batchLen; offset += chunkLen) {
+            size_t n = batchLen - offset;
+            if (n > chunkLen) {
+                n = chunkLen;
+            }
+            struct io_uring_sqe* sqe;
+            if (gap_us > 0) {
+                sqe = getSqe(tx_);
+                prepTimeout(sqe, IORING_OP_TIMEOUT, &ts);
+                sqe->flags |= IOSQE_IO_HARDLINK;
+                nSqe++;
+            }
+            sqe = getSqe(tx_);
+            prepFixedIo(sqe, IORING_OP_WRITE_FIXED, txBuf_ + offset, n);
+            if (offset + n < batchLen) {
+                sqe->flags |= IOSQE_IO_LINK;
+            }
+            nSqe++;
+        }
+
+        err = submitAndWait(tx_, nSqe, nSqe);
+        if (err < 0) {
+            break;
+        }
+
+        size_t batchWritten = 0;
+        int32_t failure = 0;
+        for (unsigned i = 0; i < nSqe; i++) {
+            uint64_t userData;
+            int32_t res;
+            reapCompletion(tx_, &userData, &res);
+            if (userData == UD_IO) {
+                if (res >= 0) {
+                    batchWritten += res;
+                } else if (res != -ECANCELED && failure == 0) {
+                    failure = res;
+                }
+            }
+        }
+        written += batchWritten;
+
+        // A full tty buffer or an interrupted write is retried from the first unsent byte
+        if (failure == -EAGAIN || failure == -EINTR) {
+            retries = (batchWritten == 0) ? retries + 1 : 0;
+            if (retries > TX_MAX_RETRIES) {
+                err = failure;
+            }
+        } else if (failure < 0) {
+            err = failure;
+        }
+    }
+
+    return (err < 0) ? err : (int)written;
+}
+
+#else
+// -------------------------------------------------------------------------------------------------
+// io_uring not available at build time: the transport never becomes active
+// -------------------------------------------------------------------------------------------------
+int UringTransport::init(int fd, uint8_t* rxBuf, size_t rxLen) {
+    return -ENOSYS;
+}
+
+void UringTransport::close(void) {
+}
+
+int UringTransport::read(size_t len, uint32_t timeout_us, size_t offset) {
+    return -ENOSYS;
+}
+
+int UringTransport::writePaced(const uint8_t* bytes, size_t len, size_t chunkLen, uint32_t gap_us) {
+    return -ENOSYS;
+}
+#endif
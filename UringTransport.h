@@ -0,0 +1,107 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef URING_TRANSPORT_H
+#define URING_TRANSPORT_H
+
+/** @file @brief io_uring based UART transport for the Linux HAL.
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include <stddef.h>
+#include <stdint.h>
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+struct UringRing;
+
+// =================================================================================================
+// CLASS DEFINITION - UringTransport
+// =================================================================================================
+/** @brief Services one tty file descriptor through io_uring.
+ *
+ * The descriptor is registered as a fixed file and the RX/TX staging buffers as fixed buffers
+ * so the kernel does not have to look them up on every operation. An RX cycle is a single
+ * POLL_ADD guarded by a LINK_TIMEOUT and linked to a READ_FIXED, which replaces the
+ * select + read pair. A paced TX frame is submitted as one chain of TIMEOUT -> WRITE_FIXED
+ * pairs, so the whole frame costs one io_uring_enter instead of one write (and one usleep) per
+ * byte.
+ *
+ * RX and TX use separate rings created with IORING_SETUP_DEFER_TASKRUN; without it the tty
+ * layer fails linked operations with -EINTR. Such a ring accepts submissions from a single
+ * thread only, so each ring is bound to the first thread that reads (or writes). Calls from
+ * any other thread return -EEXIST and the caller should use its select/read path instead.
+ *
+ * If io_uring is unavailable (kernel older than 6.1, seccomp, built without linux/io_uring.h)
+ * init() fails and the caller is expected to keep using its select/read path.
+ */
+class UringTransport {
+public:
+    explicit UringTransport(void);
+    virtual ~UringTransport(void);
+
+    /** @brief Create the ring and register the descriptor and buffers.
+     * @param fd the open tty, O_NONBLOCK. Reads are preceded by a readiness poll so they never
+     * block in a kernel worker thread.
+     * @param rxBuf buffer read() places data in. Must stay valid until close().
+     * @param rxLen length in bytes of rxBuf
+     * @return 0 on success, negative errno on failure (the transport is then inactive)
+     */
+    int init(int fd, uint8_t* rxBuf, size_t rxLen);
+
+    /** @brief Tear down the ring. The tty descriptor is not closed. */
+    void close(void);
+
+    /** @brief true if init() succeeded and the rings are usable */
+    bool isActive(void) const {
+        return rx_ != 0;
+    }
+
+    /** @brief Read up to len bytes into the registered RX buffer.
+     * @param len number of bytes requested, clipped to what fits after offset
+     * @param timeout_us how long to wait for data
+     * @param offset where in the registered buffer the data goes
+     * @return >0 number of bytes read, 0 on timeout, negative errno on error (-EEXIST if the
+     * RX ring is bound to another thread, -EIO if the tty was hung up)
+     */
+    int read(size_t len, uint32_t timeout_us, size_t offset = 0);
+
+    /** @brief Write an encoded frame as paced chunks with a single submission.
+     * @param bytes data to send
+     * @param len number of bytes
+     * @param chunkLen number of bytes written per WRITE operation (>= 1)
+     * @param gap_us delay inserted before each chunk
+     * @return number of bytes written, negative errno on error (-EEXIST if the TX ring is bound
+     * to another thread)
+     */
+    int writePaced(const uint8_t* bytes, size_t len, size_t chunkLen, uint32_t gap_us);
+
+    static const unsigned int RING_ENTRIES; /**< Submission queue depth */
+    static const size_t TX_STAGING_LEN;     /**< Bytes of registered TX staging memory */
+
+private:
+    UringRing* rx_;
+    UringRing* tx_;
+    uint8_t* rxBuf_;
+    size_t rxLen_;
+    uint8_t* txBuf_;
+};
+
+#endif // URING_TRANSPORT_H
@@ -0,0 +1,546 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file @brief Rfc1662Framer microbenchmarks.
+ *
+ * Measures encode and decode cost per byte for a set of payload distributions. Cycles and
+ * instructions come from perf_event_open when the kernel allows it, otherwise from the TSC
+ * (x86) or are left out. Before timing, each case is checked against a straightforward scalar
+ * reference framer so an optimized framer can't win by being wrong.
+ *
+ * Output follows Google Benchmark's console layout, or one JSON object per line with --json.
+ *
+ * usage: framer_bench [--min-time ms] [--json] [--filter substring]
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "Rfc1662Framer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define DATASET_BYTES (1024 * 1024) // Payload bytes per case
+#define READ_CHUNK 1024             // Bytes per decode() call, as FtdiHalRpi reads them
+#define DEST_LEN (64 * 1024)
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+typedef struct BenchCase_s {
+    const char* name;
+    size_t frameLen;   // Payload bytes per frame
+    double escapes;    // Fraction of payload bytes that are FLAG or ESC
+    bool randomSplit;  // Decode in random sized pieces instead of READ_CHUNK
+    Rfc1662Framer::Fcs_e fcs;
+} BenchCase_t;
+
+typedef struct Counters_s {
+    double ns;
+    double cycles; // < 0 if unavailable
+    double instructions;
+} Counters_t;
+
+typedef std::vector<std::vector<uint8_t> > Frames_t;
+
+// =================================================================================================
+// LOCAL CONST VARIABLES
+// =================================================================================================
+static const BenchCase_t CASES[] = {
+        {"no_escapes", 64, 0.0, false, Rfc1662Framer::FCS_NONE},
+        {"escapes_1pct", 64, 0.01, false, Rfc1662Framer::FCS_NONE},
+        {"escapes_50pct", 64, 0.5, false, Rfc1662Framer::FCS_NONE},
+        {"tiny_frames", 4, 0.01, false, Rfc1662Framer::FCS_NONE},
+        {"huge_frames", 4000, 0.01, false, Rfc1662Framer::FCS_NONE},
+        {"random_split", 64, 0.01, true, Rfc1662Framer::FCS_NONE},
+        {"fcs16", 64, 0.01, false, Rfc1662Framer::FCS_16},
+        {"fcs32", 64, 0.01, false, Rfc1662Framer::FCS_32},
+};
+
+// =================================================================================================
+// LOCAL FUNCTIONS - counters
+// =================================================================================================
+class PerfCounters {
+public:
+    PerfCounters() : cyclesFd_(-1), instrFd_(-1) {
+#ifdef __linux__
+        cyclesFd_ = open(PERF_COUNT_HW_CPU_CYCLES, -1);
+        instrFd_ = open(PERF_COUNT_HW_INSTRUCTIONS, cyclesFd_);
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        if (instrFd_ >= 0) {
+            close(instrFd_);
+        }
+        if (cyclesFd_ >= 0) {
+            close(cyclesFd_);
+        }
+#endif
+    }
+
+    const char* source() const {
+        if (cyclesFd_ >= 0) {
+            return "perf";
+        }
+        return HAVE_TSC ? "tsc" : "none";
+    }
+
+    void start() {
+#ifdef __linux__
+        if (cyclesFd_ >= 0) {
+            ioctl(cyclesFd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(cyclesFd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+#if HAVE_TSC
+        tsc0_ = __rdtsc();
+#endif
+        clock_gettime(CLOCK_MONOTONIC, &t0_);
+    }
+
+    Counters_t stop() {
+        Counters_t c;
+        struct timespec t1;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        c.ns = (t1.tv_sec - t0_.tv_sec) * 1e9 + (t1.tv_nsec - t0_.tv_nsec);
+        c.cycles = -1;
+        c.instructions = -1;
+#if HAVE_TSC
+        c.cycles = (double)(__rdtsc() - tsc0_);
+#endif
+#ifdef __linux__
+        if (cyclesFd_ >= 0) {
+            ioctl(cyclesFd_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            c.cycles = readCounter(cyclesFd_);
+            c.instructions = (instrFd_ >= 0) ? readCounter(instrFd_) : -1;
+        }
+#endif
+        return c;
+    }
+
+private:
+    int cyclesFd_;
+    int instrFd_;
+    struct timespec t0_;
+#if HAVE_TSC
+    unsigned long long tsc0_;
+#endif
+
+#ifdef __linux__
+    static int open(uint64_t config, int groupFd) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = (groupFd < 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+
+    static double readCounter(int fd) {
+        uint64_t value = 0;
+        if (read(fd, &value, sizeof(value)) != sizeof(value)) {
+            return -1;
+        }
+        return (double)value;
+    }
+#endif
+};
+
+// =================================================================================================
+// LOCAL FUNCTIONS - scalar reference framer
+// =================================================================================================
+// Bit at a time CRC, without the initial or final complement
+static uint32_t ref_crc(Rfc1662Framer::Fcs_e fcs, uint32_t crc, const uint8_t* p, size_t len) {
+    uint32_t poly = (fcs == Rfc1662Framer::FCS_32) ? 0xEDB88320u : 0x8408u;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static size_t ref_fcs_len(Rfc1662Framer::Fcs_e fcs) {
+    return (fcs == Rfc1662Framer::FCS_32) ? 4 : (fcs == Rfc1662Framer::FCS_16) ? 2 : 0;
+}
+
+static std::vector<uint8_t> ref_encode(const std::vector<uint8_t>& msg, Rfc1662Framer::Fcs_e fcs) {
+    std::vector<uint8_t> src = msg;
+    std::vector<uint8_t> out;
+    if (fcs != Rfc1662Framer::FCS_NONE) {
+        uint32_t init = (fcs == Rfc1662Framer::FCS_32) ? 0xFFFFFFFFu : 0xFFFFu;
+        uint32_t crc = ~ref_crc(fcs, init, &msg[0], msg.size());
+        for (size_t i = 0; i < ref_fcs_len(fcs); i++) {
+            src.push_back((uint8_t)(crc >> (8 * i)));
+        }
+    }
+    out.push_back(0x7E);
+    for (size_t i = 0; i < src.size(); i++) {
+        if (src[i] == 0x7E || src[i] == 0x7D) {
+            out.push_back(0x7D);
+            out.push_back(src[i] ^ 0x20);
+        } else {
+            out.push_back(src[i]);
+        }
+    }
+    out.push_back(0x7E);
+    return out;
+}
+
+static bool ref_fcs_ok(const std::vector<uint8_t>& frame, Rfc1662Framer::Fcs_e fcs) {
+    size_t fcsLen = ref_fcs_len(fcs);
+    if (fcsLen == 0) {
+        return true;
+    }
+    if (frame.size() <= fcsLen) {
+        return false;
+    }
+    uint32_t init = (fcs == Rfc1662Framer::FCS_32) ? 0xFFFFFFFFu : 0xFFFFu;
+    uint32_t crc = ~ref_crc(fcs, init, &frame[0], frame.size() - fcsLen);
+    for (size_t i = 0; i < fcsLen; i++) {
+        if (frame[frame.size() - fcsLen + i] != (uint8_t)(crc >> (8 * i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Frames_t ref_decode(const std::vector<uint8_t>& wire, Rfc1662Framer::Fcs_e fcs) {
+    Frames_t frames;
+    std::vector<uint8_t> cur;
+    bool inFrame = false;
+    bool esc = false;
+    for (size_t i = 0; i < wire.size(); i++) {
+        uint8_t b = wire[i];
+        if (b == 0x7E) {
+            if (inFrame && !esc && !cur.empty() && ref_fcs_ok(cur, fcs)) {
+                cur.resize(cur.size() - ref_fcs_len(fcs));
+                frames.push_back(cur);
+            }
+            cur.clear();
+            inFrame = true;
+            esc = false;
+        } else if (!inFrame) {
+            continue;
+        } else if (b == 0x7D) {
+            esc = true;
+        } else {
+            cur.push_back(esc ? (b ^ 0x20) : b);
+            esc = false;
+        }
+    }
+    return frames;
+}
+
+// =================================================================================================
+// LOCAL FUNCTIONS - data sets
+// =================================================================================================
+static Frames_t make_frames(const BenchCase_t& bc) {
+    Frames_t frames;
+    unsigned seed = 12345;
+    size_t total = 0;
+    while (total < DATASET_BYTES) {
+        std::vector<uint8_t> f(bc.frameLen);
+        for (size_t i = 0; i < f.size(); i++) {
+            seed = seed * 1103515245 + 12345;
+            bool esc = ((seed >> 16) % 10000) < bc.escapes * 10000;
+            uint8_t plain = (uint8_t)(seed >> 24);
+            if (plain == 0x7E || plain == 0x7D) {
+                plain = 0x55;
+            }
+            f[i] = esc ? ((seed & 1) ? 0x7E : 0x7D) : plain;
+        }
+        total += f.size();
+        frames.push_back(f);
+    }
+    return frames;
+}
+
+static std::vector<size_t> make_splits(const BenchCase_t& bc, size_t wireLen) {
+    std::vector<size_t> splits;
+    unsigned seed = 777;
+    size_t pos = 0;
+    while (pos < wireLen) {
+        size_t n = READ_CHUNK;
+        if (bc.randomSplit) {
+            seed = seed * 1103515245 + 12345;
+            n = 1 + (seed >> 16) % 256;
+        }
+        if (n > wireLen - pos) {
+            n = wireLen - pos;
+        }
+        splits.push_back(n);
+        pos += n;
+    }
+    return splits;
+}
+
+// Decode wire in the given pieces, collecting the messages the framer produces
+static Frames_t framer_decode(Rfc1662Framer& framer,
+                              uint8_t* dest,
+                              const std::vector<uint8_t>& wire,
+                              const std::vector<size_t>& splits,
+                              bool collect) {
+    Frames_t out;
+    const uint8_t* p = &wire[0];
+    framer.decodeInit(dest, DEST_LEN);
+    for (size_t s = 0; s < splits.size(); s++) {
+        int n = framer.decode(p, splits[s]);
+        p += splits[s];
+        if (collect) {
+            uint8_t* m = dest;
+            for (int i = 0; i < n; i++) {
+                size_t len = m[0] | (m[1] << 8);
+                out.push_back(std::vector<uint8_t>(m + 2, m + 2 + len));
+                m += 2 + len;
+            }
+        }
+    }
+    return out;
+}
+
+// Same, decoding in place. Copying each piece into the decoder's buffer stands in for the read()
+// that lands it there, so this compares with BM_decode plus a read into a staging buffer.
+static Frames_t framer_decode_inplace(Rfc1662Framer& framer,
+                                      uint8_t* buf,
+                                      std::vector<Rfc1662Span_t>& spans,
+                                      const std::vector<uint8_t>& wire,
+                                      const std::vector<size_t>& splits,
+                                      bool collect) {
+    Frames_t out;
+    const uint8_t* p = &wire[0];
+    framer.decodeInitInPlace(buf, DEST_LEN);
+    framer.decodeSpans(&spans[0], spans.size());
+    for (size_t s = 0; s < splits.size(); s++) {
+        size_t space;
+        memcpy(framer.decodeBuffer(&space), p, splits[s]);
+        int n = framer.decodeInPlace(splits[s]);
+        p += splits[s];
+        if (collect) {
+            for (int i = 0; i < n; i++) {
+                out.push_back(std::vector<uint8_t>(spans[i].data, spans[i].data + spans[i].len));
+            }
+        }
+    }
+    return out;
+}
+
+// =================================================================================================
+// LOCAL FUNCTIONS - reporting
+// =================================================================================================
+static void report(const std::string& name,
+                   size_t iterations,
+                   double bytes,
+                   const Counters_t& c,
+                   const char* source,
+                   bool json) {
+    double nsPerByte = c.ns / bytes;
+    double cyclesPerByte = (c.cycles >= 0) ? c.cycles / bytes : -1;
+    double instrPerByte = (c.instructions >= 0) ? c.instructions / bytes : -1;
+    double mbPerS = bytes / (c.ns / 1e9) / 1e6;
+
+    if (json) {
+        printf("{\"name\":\"%s\",\"iterations\":%zu,\"ns_per_byte\":%.4f,\"cycles_per_byte\":%.4f,"
+               "\"instructions_per_byte\":%.4f,\"mb_per_s\":%.1f,\"counter_source\":\"%s\"}\n",
+               name.c_str(),
+               iterations,
+               nsPerByte,
+               cyclesPerByte,
+               instrPerByte,
+               mbPerS,
+               source);
+    } else {
+        printf("%-36s %10zu %12.3f %12.3f %12.3f %10.1f\n",
+               name.c_str(),
+               iterations,
+               nsPerByte,
+               cyclesPerByte,
+               instrPerByte,
+               mbPerS);
+    }
+}
+
+// =================================================================================================
+// MAIN
+// =================================================================================================
+int main(int argc, char* argv[]) {
+    double minTime_ms = 200;
+    bool json = false;
+    const char* filter = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--min-time") && i + 1 < argc) {
+            minTime_ms = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--json")) {
+            json = true;
+        } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--min-time ms] [--json] [--filter substring]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    PerfCounters counters;
+    Rfc1662Framer framer;
+    std::vector<uint8_t> dest(DEST_LEN);
+    std::vector<Rfc1662Span_t> spans(DEST_LEN / 2 + 1);
+    int failures = 0;
+
+    if (!json) {
+        printf("Counters: %s\n", counters.source());
+        printf("%-36s %10s %12s %12s %12s %10s\n",
+               "Benchmark",
+               "Iterations",
+               "ns/byte",
+               "cycles/byte",
+               "instr/byte",
+               "MB/s");
+        printf("%s\n", std::string(97, '-').c_str());
+    }
+
+    for (size_t ci = 0; ci < sizeof(CASES) / sizeof(CASES[0]); ci++) {
+        const BenchCase_t& bc = CASES[ci];
+        if (filter != NULL && strstr(bc.name, filter) == NULL) {
+            continue;
+        }
+
+        Frames_t frames = make_frames(bc);
+        size_t payloadBytes = 0;
+        std::vector<uint8_t> wire;
+        for (size_t f = 0; f < frames.size(); f++) {
+            std::vector<uint8_t> e = ref_encode(frames[f], bc.fcs);
+            wire.insert(wire.end(), e.begin(), e.end());
+            payloadBytes += frames[f].size();
+        }
+        std::vector<size_t> splits = make_splits(bc, wire.size());
+
+        // Check the framer against the reference before timing anything
+        framer.setFcs(bc.fcs);
+        std::vector<uint8_t> encoded(frames.size() * framer.maxEncodedLen(bc.frameLen));
+        size_t encodedLen = 0;
+        for (size_t f = 0; f < frames.size(); f++) {
+            encodedLen += framer.encode(&encoded[encodedLen], &frames[f][0], frames[f].size());
+        }
+        bool encodeOk = (encodedLen == wire.size()) && !memcmp(&encoded[0], &wire[0], wire.size());
+        Frames_t expected = ref_decode(wire, bc.fcs);
+        bool decodeOk = (framer_decode(framer, &dest[0], wire, splits, true) == expected) &&
+                        (framer_decode_inplace(framer, &dest[0], spans, wire, splits, true) ==
+                         expected) &&
+                        (expected == frames);
+        if (!encodeOk || !decodeOk) {
+            fprintf(stderr,
+                    "%s: %s%s does not match the reference\n",
+                    bc.name,
+                    encodeOk ? "" : "encode ",
+                    decodeOk ? "" : "decode ");
+            failures++;
+            continue;
+        }
+
+        // encode: cost per payload byte
+        size_t iterations = 0;
+        Counters_t total;
+        memset(&total, 0, sizeof(total));
+        while (total.ns < minTime_ms * 1e6) {
+            counters.start();
+            size_t n = 0;
+            for (size_t f = 0; f < frames.size(); f++) {
+                n += framer.encode(&encoded[n], &frames[f][0], frames[f].size());
+            }
+            Counters_t c = counters.stop();
+            total.ns += c.ns;
+            total.cycles = (c.cycles < 0) ? -1 : total.cycles + c.cycles;
+            total.instructions = (c.instructions < 0) ? -1 : total.instructions + c.instructions;
+            iterations++;
+        }
+        report(std::string("BM_encode/") + bc.name,
+               iterations,
+               (double)payloadBytes * iterations,
+               total,
+               counters.source(),
+               json);
+
+        // decode: cost per wire byte
+        iterations = 0;
+        memset(&total, 0, sizeof(total));
+        while (total.ns < minTime_ms * 1e6) {
+            counters.start();
+            framer_decode(framer, &dest[0], wire, splits, false);
+            Counters_t c = counters.stop();
+            total.ns += c.ns;
+            total.cycles = (c.cycles < 0) ? -1 : total.cycles + c.cycles;
+            total.instructions = (c.instructions < 0) ? -1 : total.instructions + c.instructions;
+            iterations++;
+        }
+        report(std::string("BM_decode/") + bc.name,
+               iterations,
+               (double)wire.size() * iterations,
+               total,
+               counters.source(),
+               json);
+
+        // in place decode: cost per wire byte
+        iterations = 0;
+        memset(&total, 0, sizeof(total));
+        while (total.ns < minTime_ms * 1e6) {
+            counters.start();
+            framer_decode_inplace(framer, &dest[0], spans, wire, splits, false);
+            Counters_t c = counters.stop();
+            total.ns += c.ns;
+            total.cycles = (c.cycles < 0) ? -1 : total.cycles + c.cycles;
+            total.instructions = (c.instructions < 0) ? -1 : total.instructions + c.instructions;
+            iterations++;
+        }
+        report(std::string("BM_decode_inplace/") + bc.name,
+               iterations,
+               (double)wire.size() * iterations,
+               total,
+               counters.source(),
+               json);
+    }
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,380 @@
+/*
+ * Copyright 2018-21 CEVA, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with CEVA, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file @brief End-to-end throughput/latency benchmark for FtdiHalRpi.
+ *
+ * A pty stands in for the FTDI tty. A peer thread on the master side plays the hub: it frames
+ * SHTP sensor reports with Rfc1662Framer at a given rate, size and escape density and stamps
+ * each one with CLOCK_MONOTONIC. The main thread consumes them through FtdiHalRpi::read().
+ *
+ * Each sweep point prints one JSON object per line:
+ *   rate, size, escapes    the point parameters (rate 0 = as fast as the pty accepts)
+ *   msgs_per_s, mb_per_s   sustained consumer throughput (payload bytes)
+ *   lat_us_p50..max        wire-to-consumer latency percentiles
+ *   cpu_us_per_mb          consumer thread CPU time per MB of payload
+ *   tx_us_p50, tx_us_max   FtdiHal::write() latency of a 21 byte command
+ *   sent, received         message counts (difference = drops)
+ *
+ * usage: hal_bench [--duration ms] [--io-uring] [--busy-poll us] [--quick] [--out file]
+ */
+
+// =================================================================================================
+// INCLUDE FILES
+// =================================================================================================
+#include "FtdiHalRpi.h"
+#include "Rfc1662Framer.h"
+#include "TimerService.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// =================================================================================================
+// DEFINES AND MACROS
+// =================================================================================================
+#define SHTP_CHAN_SENSOR 3
+#define STAMP_OFFSET 5 // UART header + SHTP header
+#define MIN_MSG_LEN (STAMP_OFFSET + 8)
+#define DRAIN_IDLE_US 50000
+#define TX_SAMPLES 20
+
+// =================================================================================================
+// DATA TYPES
+// =================================================================================================
+typedef struct BenchPoint_s {
+    unsigned rate; // messages/s, 0 = unthrottled
+    unsigned size; // message length including UART and SHTP headers
+    double escapes; // fraction of filler bytes that need escaping
+} BenchPoint_t;
+
+typedef struct BenchOptions_s {
+    unsigned duration_ms;
+    bool ioUring;
+    unsigned busyPoll_us;
+    bool quick;
+    const char* outPath;
+} BenchOptions_t;
+
+// =================================================================================================
+// LOCAL FUNCTIONS
+// =================================================================================================
+static uint64_t now_ns(clockid_t clk = CLOCK_MONOTONIC) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t percentile(std::vector<uint64_t>& v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t idx = (size_t)(p * (v.size() - 1));
+    return v[idx];
+}
+
+// -------------------------------------------------------------------------------------------------
+// Peer: generates framed SHTP messages on the pty master
+// -------------------------------------------------------------------------------------------------
+class BenchPeer {
+public:
+    BenchPeer(int master) : master_(master), stop_(false), sent_(0) {
+    }
+
+    void run(const BenchPoint_t& pt, unsigned duration_ms) {
+        Rfc1662Framer framer;
+        std::vector<uint8_t> msg(pt.size);
+        std::vector<uint8_t> out;
+        uint8_t seq = 0;
+        unsigned seed = 1;
+
+        uint64_t start = now_ns();
+        uint64_t end = start + (uint64_t)duration_ms * 1000000ULL;
+        double credit = 0;
+        uint64_t last = start;
+
+        sent_ = 0;
+        while (!stop_) {
+            uint64_t t = now_ns();
+            if (t >= end) {
+                break;
+            }
+
+            // Messages owed since the last tick, or one batch when unthrottled
+            unsigned n;
+            if (pt.rate == 0) {
+                n = 16;
+            } else {
+                credit += (double)(t - last) * pt.rate / 1e9;
+                n = (unsigned)credit;
+                credit -= n;
+            }
+            last = t;
+
+            out.clear();
+            for (unsigned i = 0; i < n; i++) {
+                uint16_t shtpLen = (uint16_t)(pt.size - 1);
+                msg[0] = 0x01;
+                msg[1] = shtpLen & 0xFF;
+                msg[2] = shtpLen >> 8;
+                msg[3] = SHTP_CHAN_SENSOR;
+                msg[4] = seq++;
+                for (size_t b = MIN_MSG_LEN; b < msg.size(); b++) {
+                    seed = seed * 1103515245 + 12345;
+                    bool esc = ((seed >> 16) % 10000) < pt.escapes * 10000;
+                    msg[b] = esc ? ((seed & 1) ? Rfc1662Framer::FLAG : Rfc1662Framer::ESC)
+                                 : (uint8_t)(0x30 + (seed >> 24) % 64);
+                }
+                uint64_t stamp = now_ns();
+                memcpy(&msg[STAMP_OFFSET], &stamp, sizeof(stamp));
+
+                size_t at = out.size();
+                out.resize(at + msg.size() * 2 + 2);
+                out.resize(at + framer.encode(&out[at], &msg[0], msg.size()));
+            }
+
+            size_t off = 0;
+            while (off < out.size()) {
+                ssize_t w = ::write(master_, &out[off], out.size() - off);
+                if (w > 0) {
+                    off += w;
+                } else if (errno == EAGAIN && !stop_) {
+                    usleep(100); // consumer is behind, the pty is full
+                } else {
+                    break;
+                }
+            }
+            sent_ += n;
+
+            if (pt.rate != 0) {
+                usleep(1000);
+            }
+        }
+    }
+
+    void stop() {
+        stop_ = true;
+    }
+
+    unsigned sent() const {
+        return sent_;
+    }
+
+private:
+    int master_;
+    std::atomic<bool> stop_;
+    std::atomic<unsigned> sent_;
+};
+
+// -------------------------------------------------------------------------------------------------
+// Drain whatever the HAL wrote (soft reset, TX probes) so the pty never fills up
+// -------------------------------------------------------------------------------------------------
+static void drain_master(int master, std::atomic<bool>* stop) {
+    uint8_t buf[1024];
+    while (!*stop) {
+        if (::read(master, buf, sizeof(buf)) <= 0) {
+            usleep(1000);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+// One sweep point
+// -------------------------------------------------------------------------------------------------
+static void run_point(FtdiHalRpi& hal, int master, const BenchPoint_t& pt, const BenchOptions_t& opt,
+                      FILE* out) {
+    BenchPeer peer(master);
+    std::vector<uint64_t> lat;
+    uint8_t buf[2048];
+    uint32_t t_us;
+    unsigned received = 0;
+    uint64_t bytes = 0;
+
+    lat.reserve(1 << 20);
+
+    uint64_t cpu0 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t t0 = now_ns();
+    std::thread gen(&BenchPeer::run, &peer, pt, opt.duration_ms);
+
+    uint64_t lastRx = now_ns();
+    uint64_t lastMsg = t0;
+    while (true) {
+        int len = hal.read(buf, sizeof(buf), &t_us);
+        uint64_t t = now_ns();
+        if (len >= MIN_MSG_LEN - 1) {
+            uint64_t stamp;
+            memcpy(&stamp, &buf[STAMP_OFFSET - 1], sizeof(stamp));
+            lat.push_back(t - stamp);
+            received++;
+            bytes += len;
+            lastRx = t;
+            lastMsg = t;
+        } else if (t - t0 > (uint64_t)opt.duration_ms * 1000000ULL &&
+                   t - lastRx > DRAIN_IDLE_US * 1000ULL) {
+            break;
+        }
+    }
+    gen.join();
+    uint64_t cpu = now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu0;
+    double secs = (lastMsg - t0) / 1e9;
+
+    // TX command latency with the current pacing
+    std::vector<uint64_t> tx;
+    uint8_t cmd[21] = {0x15, 0x00, 0x02, 0x00, 0xFD, 0x01};
+    for (int i = 0; i < TX_SAMPLES; i++) {
+        uint64_t w0 = now_ns();
+        hal.write(cmd, sizeof(cmd));
+        tx.push_back(now_ns() - w0);
+    }
+
+    std::sort(lat.begin(), lat.end());
+    std::sort(tx.begin(), tx.end());
+    double mb = bytes / 1e6;
+
+    fprintf(out,
+            "{\"rate\":%u,\"size\":%u,\"escapes\":%.2f,\"sent\":%u,\"received\":%u,"
+            "\"msgs_per_s\":%.1f,\"mb_per_s\":%.3f,"
+            "\"lat_us_p50\":%.1f,\"lat_us_p90\":%.1f,\"lat_us_p99\":%.1f,\"lat_us_p999\":%.1f,"
+            "\"lat_us_max\":%.1f,\"cpu_us_per_mb\":%.1f,\"tx_us_p50\":%.1f,\"tx_us_max\":%.1f}\n",
+            pt.rate,
+            pt.size,
+            pt.escapes,
+            peer.sent(),
+            received,
+            (secs > 0) ? received / secs : 0.0,
+            (secs > 0) ? mb / secs : 0.0,
+            percentile(lat, 0.50) / 1e3,
+            percentile(lat, 0.90) / 1e3,
+            percentile(lat, 0.99) / 1e3,
+            percentile(lat, 0.999) / 1e3,
+            lat.empty() ? 0.0 : lat.back() / 1e3,
+            (mb > 0) ? (cpu / 1e3) / mb : 0.0,
+            percentile(tx, 0.50) / 1e3,
+            tx.empty() ? 0.0 : tx.back() / 1e3);
+    fflush(out);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [--duration ms] [--io-uring] [--busy-poll us] [--quick] [--out file]\n",
+            prog);
+}
+
+// =================================================================================================
+// MAIN
+// =================================================================================================
+int main(int argc, char* argv[]) {
+    BenchOptions_t opt;
+    opt.duration_ms = 1000;
+    opt.ioUring = false;
+    opt.busyPoll_us = 0;
+    opt.quick = false;
+    opt.outPath = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--duration") && i + 1 < argc) {
+            opt.duration_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--io-uring")) {
+            opt.ioUring = true;
+        } else if (!strcmp(argv[i], "--busy-poll") && i + 1 < argc) {
+            opt.busyPoll_us = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--quick")) {
+            opt.quick = true;
+        } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+            opt.outPath = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    FILE* out = stdout;
+    if (opt.outPath != NULL) {
+        out = fopen(opt.outPath, "w");
+        if (out == NULL) {
+            fprintf(stderr, "unable to open %s\n", opt.outPath);
+            return 1;
+        }
+    }
+
+    int master, slave;
+    char name[64];
+    if (openpty(&master, &slave, name, NULL, NULL) != 0) {
+        perror("openpty");
+        return 1;
+    }
+    struct termios tty;
+    tcgetattr(master, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(master, TCSANOW, &tty);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    TimerSrvRpi timer;
+    timer.init();
+    FtdiHalRpi hal;
+    hal.init(name, &timer);
+    hal.setIoUring(opt.ioUring);
+    hal.setBusyPoll(opt.busyPoll_us);
+
+    // The master is shared by the generator (writes) and the drain thread (reads)
+    std::atomic<bool> stopDrain(false);
+    std::thread drain(drain_master, master, &stopDrain);
+
+    if (hal.open() != 0) {
+        fprintf(stderr, "unable to open %s\n", name);
+        return 1;
+    }
+
+    static const unsigned rates[] = {1000, 4000, 0};
+    static const unsigned sizes[] = {16, 64, 256};
+    static const double escapes[] = {0.0, 0.01, 0.5};
+    unsigned nRates = opt.quick ? 1 : sizeof(rates) / sizeof(rates[0]);
+    unsigned nSizes = opt.quick ? 1 : sizeof(sizes) / sizeof(sizes[0]);
+    unsigned nEscapes = opt.quick ? 1 : sizeof(escapes) / sizeof(escapes[0]);
+
+    for (unsigned r = 0; r < nRates; r++) {
+        for (unsigned s = 0; s < nSizes; s++) {
+            for (unsigned e = 0; e < nEscapes; e++) {
+                BenchPoint_t pt;
+                pt.rate = rates[r];
+                pt.size = sizes[s];
+                pt.escapes = escapes[e];
+                run_point(hal, master, pt, opt, out);
+            }
+        }
+    }
+
+    hal.close();
+    stopDrain = true;
+    drain.join();
+    ::close(slave);
+    ::close(master);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return 0;
+}